@@ -0,0 +1,215 @@
+/*
+ * Host tool: rewrite an ELF kernel so that each loadable segment is
+ * stored as an LZ4 block, for the boot loader to decompress in place.
+ *
+ *	lz4pack kernel kernel.z
+ *
+ * The output starts with the original ELF header and program headers.
+ * Each ELF_PROG_LOAD segment with file data becomes ELF_PROG_LOAD_LZ4:
+ * p_offset points at a sector-aligned LZ4 block and p_filesz is the
+ * block's compressed size; p_pa and p_memsz are unchanged.  Sections
+ * are dropped, since nothing reads them from the disk image.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <inc/elf.h>
+
+#define SECTSIZE	512
+#define HDRSIZE		4096	// bytes of header bootmain() reads first
+
+// LZ4 block format parameters
+#define MINMATCH	4	// shortest match the format can encode
+#define LASTLITERALS	5	// the last 5 bytes are always literals
+#define MFLIMIT		12	// the last match starts this far before the end
+#define MAXOFFSET	65535
+#define HASHLOG		16
+
+static uint32_t
+read32(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, 4);
+	return v;
+}
+
+static uint32_t
+hash(uint32_t v)
+{
+	return (v * 2654435761U) >> (32 - HASHLOG);
+}
+
+static uint8_t *
+put_len(uint8_t *op, size_t len)
+{
+	for (; len >= 255; len -= 255)
+		*op++ = 255;
+	*op++ = len;
+	return op;
+}
+
+static uint8_t *
+put_literals(uint8_t *op, const uint8_t *lit, size_t nlit, size_t mlen)
+{
+	*op++ = (nlit < 15 ? nlit : 15) << 4
+		| (mlen < 15 + MINMATCH ? mlen - MINMATCH : 15);
+	if (nlit >= 15)
+		op = put_len(op, nlit - 15);
+	memcpy(op, lit, nlit);
+	return op + nlit;
+}
+
+// Compress 'n' bytes at 'src' into 'dst' as a single LZ4 block, using
+// greedy matching against a hash of the last position each 4-byte
+// sequence was seen at.  'dst' must hold n + n/255 + 16 bytes.
+// Returns the compressed size.
+static size_t
+lz4_compress(const uint8_t *src, size_t n, uint8_t *dst)
+{
+	static uint32_t table[1 << HASHLOG];	// position + 1, 0 if none
+	const uint8_t *ip, *anchor, *ref, *end;
+	uint8_t *op;
+	uint32_t h;
+	size_t mlen;
+
+	memset(table, 0, sizeof(table));
+	ip = anchor = src;
+	end = src + n;
+	op = dst;
+
+	while (n > MFLIMIT && ip < end - MFLIMIT) {
+		h = hash(read32(ip));
+		ref = table[h] ? src + table[h] - 1 : NULL;
+		table[h] = ip - src + 1;
+		if (ref == NULL || ip - ref > MAXOFFSET
+		    || read32(ref) != read32(ip)) {
+			ip++;
+			continue;
+		}
+
+		for (mlen = MINMATCH;
+		     ip + mlen < end - LASTLITERALS && ref[mlen] == ip[mlen];
+		     mlen++)
+			/* do nothing */;
+
+		op = put_literals(op, anchor, ip - anchor, mlen);
+		*op++ = (ip - ref) & 0xFF;
+		*op++ = (ip - ref) >> 8;
+		if (mlen >= 15 + MINMATCH)
+			op = put_len(op, mlen - 15 - MINMATCH);
+
+		ip += mlen;
+		anchor = ip;
+	}
+
+	// the final sequence is literals only
+	op = put_literals(op, anchor, end - anchor, MINMATCH);
+	return op - dst;
+}
+
+static void *
+xmalloc(size_t n)
+{
+	void *p;
+
+	if ((p = calloc(1, n ? n : 1)) == NULL) {
+		fprintf(stderr, "lz4pack: out of memory\n");
+		exit(1);
+	}
+	return p;
+}
+
+int
+main(int argc, char **argv)
+{
+	FILE *f;
+	uint8_t *in, *out;
+	long insize;
+	size_t outsize, zsize, hdrsize;
+	size_t rawbytes, zbytes, rawsects, zsects;
+	struct Elf *elf;
+	struct Proghdr *ph;
+	int i;
+
+	if (argc != 3) {
+		fprintf(stderr, "Usage: lz4pack kernel kernel.z\n");
+		exit(2);
+	}
+
+	if ((f = fopen(argv[1], "rb")) == NULL) {
+		perror(argv[1]);
+		exit(1);
+	}
+	fseek(f, 0, SEEK_END);
+	insize = ftell(f);
+	rewind(f);
+	in = xmalloc(insize);
+	if (fread(in, 1, insize, f) != (size_t) insize) {
+		perror(argv[1]);
+		exit(1);
+	}
+	fclose(f);
+
+	elf = (struct Elf *) in;
+	if (insize < (long) sizeof(*elf) || elf->e_magic != ELF_MAGIC) {
+		fprintf(stderr, "lz4pack: %s: not an ELF file\n", argv[1]);
+		exit(1);
+	}
+	hdrsize = elf->e_phoff + elf->e_phnum * sizeof(struct Proghdr);
+	if (hdrsize > HDRSIZE) {
+		fprintf(stderr, "lz4pack: %s: program headers past %d bytes\n",
+			argv[1], HDRSIZE);
+		exit(1);
+	}
+
+	// worst case every segment grows by n/255 + 16 plus sector padding
+	out = xmalloc(HDRSIZE + 2 * insize + elf->e_phnum * (SECTSIZE + 16));
+	memcpy(out, in, hdrsize);
+	elf = (struct Elf *) out;
+	elf->e_shoff = 0;
+	elf->e_shnum = 0;
+	elf->e_shstrndx = ELF_SHN_UNDEF;
+
+	// Either loader reads the header block, then the sectors each
+	// segment's file bytes touch; count both images that way.
+	outsize = HDRSIZE;
+	rawbytes = zbytes = 0;
+	rawsects = zsects = HDRSIZE / SECTSIZE;
+	ph = (struct Proghdr *) (out + elf->e_phoff);
+	for (i = 0; i < elf->e_phnum; i++, ph++) {
+		if (ph->p_type != ELF_PROG_LOAD || ph->p_filesz == 0)
+			continue;
+		if ((long) (ph->p_offset + ph->p_filesz) > insize) {
+			fprintf(stderr, "lz4pack: %s: segment %d truncated\n",
+				argv[1], i);
+			exit(1);
+		}
+		zsize = lz4_compress(in + ph->p_offset, ph->p_filesz,
+				     out + outsize);
+		rawbytes += ph->p_filesz;
+		zbytes += zsize;
+		rawsects += (ph->p_offset + ph->p_filesz + SECTSIZE - 1) / SECTSIZE
+			- ph->p_offset / SECTSIZE;
+		zsects += (zsize + SECTSIZE - 1) / SECTSIZE;
+		ph->p_type = ELF_PROG_LOAD_LZ4;
+		ph->p_offset = outsize;
+		ph->p_filesz = zsize;
+		outsize = (outsize + zsize + SECTSIZE - 1) & ~(SECTSIZE - 1);
+	}
+
+	if ((f = fopen(argv[2], "wb")) == NULL
+	    || fwrite(out, 1, outsize, f) != outsize || fclose(f) != 0) {
+		perror(argv[2]);
+		exit(1);
+	}
+
+	fprintf(stderr, "kernel segments packed from %lu to %lu bytes "
+		"(%lu -> %lu sectors read at boot)\n",
+		(unsigned long) rawbytes, (unsigned long) zbytes,
+		(unsigned long) rawsects, (unsigned long) zsects);
+	return 0;
+}
@@ -1,5 +1,7 @@
 #include <inc/x86.h>
 #include <inc/elf.h>
+#include <inc/boottime.h>
+#include <inc/multiboot.h>
 
 /**********************************************************************
  * This a dirt simple boot loader, whose sole job is to boot
@@ -7,11 +9,14 @@
  *
  * DISK LAYOUT
  *  * This program(boot.S and main.c) is the bootloader.  It should
- *    be stored in the first sector of the disk.
+ *    be stored in the first BOOTSECTS sectors of the disk; boot.S
+ *    must fit in the first one.
  * 
- *  * The 2nd sector onward holds the kernel image.
+ *  * Sector BOOTSECTS onward holds the kernel image.
  *	
- *  * The kernel image must be in ELF format.
+ *  * The kernel image must be in ELF format.  Segments of type
+ *    ELF_PROG_LOAD_LZ4 (see boot/lz4pack.c) are stored compressed and
+ *    are decompressed into place.
  *
  * BOOT UP STEPS	
  *  * when the CPU boots it loads the BIOS into memory and executes it
@@ -23,41 +28,198 @@
  *  * Assuming this boot loader is stored in the first sector of the
  *    hard-drive, this code takes over...
  *
- *  * control starts in boot.S -- which sets up protected mode,
- *    and a stack so C code then run, then calls bootmain()
+ *  * control starts in boot.S -- which reads in the rest of the loader,
+ *    sets up protected mode, and a stack so C code then run, then
+ *    calls bootmain()
  *
  *  * bootmain() in this file takes over, reads in the kernel and jumps to it.
+ *    Under QEMU, if the image is supplied as fw_cfg file opt/jos/kernel
+ *    (see QEMUOPTS in GNUmakefile), it is read through fw_cfg DMA, along
+ *    with an optional opt/jos/initrd passed on as a Multiboot module.
+ *    Otherwise it comes off the disk: by DMA if the IDE controller can
+ *    bus-master (e.g., QEMU's PIIX), or else by programmed I/O.
  **********************************************************************/
 
 #define SECTSIZE	512
+#define MAXSECTS	255	// most sectors one READ SECTORS command can ask for
 #define ELFHDR		((struct Elf *) 0x10000) // scratch space
+#define BOOTTIME	((struct Boottime *) physptr(BOOTTIME_PA))
+#define MBINFO		((struct Multiboot_info *) physptr(MULTIBOOT_INFO_PA))
+#define MBMODS		((struct Multiboot_mod *) physptr(MULTIBOOT_MODS_PA))
 
-void readsect(void*, uint32_t);
+// PCI configuration space, mechanism #1
+#define PCI_CONF_ADDR	0xCF8
+#define PCI_CONF_DATA	0xCFC
+#define PCI_CMD		0x04	// command register
+#define   PCI_CMD_IO	0x0001	//   respond to I/O space accesses
+#define   PCI_CMD_MASTER 0x0004	//   allow bus mastering
+#define PCI_CLASS	0x08	// class, subclass, prog-if and revision
+#define PCI_BAR4	0x20	// bus-master IDE register base
+
+// Bus-master IDE registers for the primary channel (SFF-8038i)
+#define BM_CMD		0	// command
+#define   BM_CMD_START	0x01	//   start transfer
+#define   BM_CMD_READ	0x08	//   transfer direction: disk to memory
+#define BM_STATUS	2	// status
+#define   BM_STATUS_ERR	0x02	//   transfer failed (write 1 to clear)
+#define   BM_STATUS_IRQ	0x04	//   drive raised its interrupt (ditto)
+#define BM_PRDT		4	// physical address of the PRD table
+
+// A physical region descriptor: one chunk of a DMA transfer,
+// which must not cross a 64KB boundary.
+struct Prd {
+	uint32_t addr;
+	uint16_t count;		// bytes; 0 means 64KB
+	uint16_t flags;
+};
+#define PRD_EOT		0x8000	// last descriptor in the table
+
+static uint16_t bmide;		// bus-master register base, 0 if none
+// MAXSECTS sectors span at most three 64KB windows
+static struct Prd prdt[3] __attribute__((__aligned__(8)));
+
+// QEMU's firmware configuration device (see QEMU's docs/specs/fw_cfg.txt)
+#define FW_CFG_SEL	0x510	// selector (16-bit)
+#define FW_CFG_DATA	0x511	// data (8-bit)
+#define FW_CFG_DMA	0x514	// DMA descriptor address, big-endian 64-bit
+#define FW_CFG_SIGNATURE 0x0000	// "QEMU"
+#define FW_CFG_ID	0x0001	// feature bits
+#define   FW_CFG_ID_DMA	0x02	//   DMA interface present
+#define FW_CFG_FILE_DIR	0x0019	// directory of named files
+
+// A fw_cfg DMA descriptor; every field is big-endian
+struct Fwcfg_dma {
+	uint32_t control;
+	uint32_t length;
+	uint32_t addr_hi;
+	uint32_t addr_lo;
+};
+#define FW_CFG_DMA_ERROR  0x01	// set by QEMU on failure
+#define FW_CFG_DMA_READ	  0x02
+#define FW_CFG_DMA_SKIP	  0x04
+#define FW_CFG_DMA_SELECT 0x08	// selector in the high 16 bits
+
+// A fw_cfg file directory entry, also big-endian
+struct Fwcfg_file {
+	uint32_t size;
+	uint16_t select;
+	uint16_t reserved;
+	char name[56];
+};
+
+static uint16_t fwcfg_kernel;	// selector of opt/jos/kernel, 0 if none
+static uint16_t fwcfg_initrd;	// selector of opt/jos/initrd, 0 if none
+static uint32_t initrd_size;
+
+void bmide_init(void);
+void fwcfg_init(void);
+int fwcfg_read(uint16_t, uint32_t, uint32_t, uint32_t);
+void readsects(void*, uint32_t, uint32_t);
 void readseg(uint32_t, uint32_t, uint32_t);
+void zeroseg(uint32_t, uint32_t);
+uint32_t lz4_decode(uint32_t, const uint8_t *, uint32_t);
+
+// The loader's records in low memory (BOOTTIME, MBINFO, ...) sit at
+// fixed physical addresses.  Passing each address through an empty asm
+// hides it from GCC, which otherwise takes a constant pointer into the
+// first page for a pointer to nothing and flags every access with
+// -Warray-bounds.
+static inline void *
+physptr(uint32_t pa)
+{
+	void *p;
+
+	asm("" : "=r" (p) : "0" (pa));
+	return p;
+}
 
 void
 bootmain(void)
 {
 	struct Proghdr *ph, *eph;
+	uint32_t zbuf, end;
+	int i;
 
-	// read 1st page off disk
+	// boot.S already stamped BT_START and BT_PROT
+	for (i = BT_PROT + 1; i < BT_NSTAMP; i++)
+		BOOTTIME->bt_tsc[i] = 0;
+	BOOTTIME->bt_nseg = 0;
+	BOOTTIME->bt_magic = BOOTTIME_MAGIC;
+
+	fwcfg_init();
+	if (!fwcfg_kernel)
+		bmide_init();
+
+	// read 1st page of the kernel image
 	readseg((uint32_t) ELFHDR, SECTSIZE*8, 0);
 
 	// is this a valid ELF?
 	if (ELFHDR->e_magic != ELF_MAGIC)
 		goto bad;
 
-	// load each program segment (ignores ph flags)
 	ph = (struct Proghdr *) ((uint8_t *) ELFHDR + ELFHDR->e_phoff);
 	eph = ph + ELFHDR->e_phnum;
-	for (; ph < eph; ph++)
+
+	// compressed segments are staged just past the highest segment
+	for (zbuf = 0; ph < eph; ph++)
+		if (ph->p_pa + ph->p_memsz > zbuf)
+			zbuf = ph->p_pa + ph->p_memsz;
+	zbuf = ROUNDUP(zbuf, SECTSIZE);
+
+	// load each program segment (ignores ph flags)
+	for (ph = eph - ELFHDR->e_phnum; ph < eph; ph++) {
+		// segments with nothing on disk (e.g., all .bss) cost no
+		// I/O; the kernel clears its own BSS in i386_init()
+		if (ph->p_filesz == 0)
+			continue;
 		// p_pa is the load address of this segment (as well
-		// as the physical address)
-		readseg(ph->p_pa, ph->p_memsz, ph->p_offset);
+		// as the physical address).  Only the first p_filesz
+		// bytes are on disk; the rest of p_memsz is zero.
+		if (ph->p_type == ELF_PROG_LOAD) {
+			readseg(ph->p_pa, ph->p_filesz, ph->p_offset);
+			end = ph->p_pa + ph->p_filesz;
+		} else if (ph->p_type == ELF_PROG_LOAD_LZ4) {
+			// p_filesz is the size of the compressed block
+			readseg(zbuf + ph->p_offset % SECTSIZE,
+				ph->p_filesz, ph->p_offset);
+			end = lz4_decode(ph->p_pa, (uint8_t *) zbuf
+					 + ph->p_offset % SECTSIZE,
+					 ph->p_filesz);
+		} else
+			continue;
+		if (ph->p_pa + ph->p_memsz > end)
+			zeroseg(end, ph->p_pa + ph->p_memsz - end);
+	}
+
+	// Hand the kernel boot.S's memory map the way a Multiboot
+	// loader would: magic in %eax, information structure in %ebx.
+	MBINFO->flags = 0;
+	MBINFO->mmap_length = *(uint32_t *) physptr(MULTIBOOT_MMAP_PA);
+	MBINFO->mmap_addr = MULTIBOOT_MMAP_PA + 4;
+	if (MBINFO->mmap_length > 0)
+		MBINFO->flags = MULTIBOOT_INFO_MEM_MAP;
+
+	// The initial ramdisk, if any, goes on the first page past the
+	// kernel (the compressed segments' staging area is free again)
+	// and is passed on as the one Multiboot module.
+	if (fwcfg_initrd) {
+		MBMODS->mod_start = ROUNDUP(zbuf, 4096);
+		MBMODS->mod_end = MBMODS->mod_start + initrd_size;
+		MBMODS->string = 0;
+		// there is no other copy to fall back on
+		if (fwcfg_read(fwcfg_initrd, 0, MBMODS->mod_start,
+			       initrd_size) < 0)
+			goto bad;
+		MBINFO->mods_count = 1;
+		MBINFO->mods_addr = MULTIBOOT_MODS_PA;
+		MBINFO->flags |= MULTIBOOT_INFO_MODS;
+	}
 
 	// call the entry point from the ELF header
 	// note: does not return!
-	((void (*)(void)) (ELFHDR->e_entry))();
+	asm volatile("jmp *%0"
+		: : "r" (ELFHDR->e_entry), "a" (MULTIBOOT_BOOTLOADER_MAGIC),
+		    "b" (MBINFO));
 
 bad:
 	outw(0x8A00, 0x8A00);
@@ -71,27 +233,225 @@ bad:
 void
 readseg(uint32_t pa, uint32_t count, uint32_t offset)
 {
-	uint32_t end_pa;
+	uint32_t end_pa, nsect;
+
+	if (fwcfg_kernel) {
+		if (fwcfg_read(fwcfg_kernel, offset, pa, count) == 0)
+			goto done;
+		// The disk image holds the same kernel; read it from
+		// there from now on, as the DMA path does on errors.
+		fwcfg_kernel = 0;
+		bmide_init();
+	}
 
 	end_pa = pa + count;
 	
 	// round down to sector boundary
 	pa &= ~(SECTSIZE - 1);
 
-	// translate from bytes to sectors, and kernel starts at sector 1
-	offset = (offset / SECTSIZE) + 1;
+	// translate from bytes to sectors; kernel starts after the loader
+	offset = (offset / SECTSIZE) + BOOTSECTS;
 
-	// If this is too slow, we could read lots of sectors at a time.
+	// Read contiguous runs of up to MAXSECTS sectors per disk command.
 	// We'd write more to memory than asked, but it doesn't matter --
 	// we load in increasing order.
 	while (pa < end_pa) {
+		nsect = (end_pa - pa + SECTSIZE - 1) / SECTSIZE;
+		if (nsect > MAXSECTS)
+			nsect = MAXSECTS;
 		// Since we haven't enabled paging yet and we're using
 		// an identity segment mapping (see boot.S), we can
 		// use physical addresses directly.  This won't be the
 		// case once JOS enables the MMU.
-		readsect((uint8_t*) pa, offset);
-		pa += SECTSIZE;
-		offset++;
+		readsects((uint8_t*) pa, offset, nsect);
+		pa += nsect * SECTSIZE;
+		offset += nsect;
+	}
+
+done:
+	if (BOOTTIME->bt_nseg < BT_NSEG)
+		BOOTTIME->bt_tsc[BT_SEG + BOOTTIME->bt_nseg++] = read_tsc();
+}
+
+// Zero 'count' bytes at physical address 'pa'.
+// Must be called after readseg(), which may overshoot into this range.
+void
+zeroseg(uint32_t pa, uint32_t count)
+{
+	uint32_t head, words, tail;
+
+	// bytes up to a word boundary, then whole words, then the rest
+	head = MIN(-pa & 3, count);
+	words = (count - head) / 4;
+	tail = (count - head) % 4;
+	asm volatile("cld; rep stosb\n"
+		: "+D" (pa), "+c" (head) : "a" (0) : "cc", "memory");
+	asm volatile("rep stosl\n"
+		: "+D" (pa), "+c" (words) : "a" (0) : "cc", "memory");
+	asm volatile("rep stosb\n"
+		: "+D" (pa), "+c" (tail) : "a" (0) : "cc", "memory");
+}
+
+// Decode the 'n'-byte LZ4 block at 'src' to physical address 'pa'.
+// Returns the physical address just past the decoded data.
+uint32_t
+lz4_decode(uint32_t pa, const uint8_t *src, uint32_t n)
+{
+	const uint8_t *end, *match;
+	uint8_t *dst;
+	uint32_t len;
+	uint8_t token;
+
+	dst = (uint8_t *) pa;
+	end = src + n;
+	while (src < end) {
+		token = *src++;
+
+		// a run of literals; lengths of 15 or more continue in
+		// the following bytes, each 255 meaning "and more"
+		len = token >> 4;
+		if (len == 15)
+			do
+				len += *src;
+			while (*src++ == 255);
+		asm volatile("cld; rep movsb\n"
+			: "+D" (dst), "+S" (src), "+c" (len) : : "cc", "memory");
+
+		// the last sequence has no match
+		if (src >= end)
+			break;
+
+		// then a match: 16-bit back offset and length - 4
+		match = dst - (src[0] | (src[1] << 8));
+		src += 2;
+		len = token & 15;
+		if (len == 15)
+			do
+				len += *src;
+			while (*src++ == 255);
+		len += 4;
+		// the match may overlap the bytes it produces, so copy
+		// strictly a byte at a time
+		while (len-- > 0)
+			*dst++ = *match++;
+	}
+	return (uint32_t) dst;
+}
+
+static uint32_t
+bswap(uint32_t v)
+{
+	asm("bswap %0" : "+r" (v));
+	return v;
+}
+
+static int
+streq(const char *a, const char *b)
+{
+	while (*a && *a == *b)
+		a++, b++;
+	return *a == *b;
+}
+
+// Look for QEMU's fw_cfg device with DMA support, and in its file
+// directory for the kernel image and initial ramdisk.
+void
+fwcfg_init(void)
+{
+	struct Fwcfg_file f;
+	uint32_t n;
+
+	fwcfg_kernel = fwcfg_initrd = 0;
+
+	outw(FW_CFG_SEL, FW_CFG_SIGNATURE);
+	insb(FW_CFG_DATA, &n, 4);
+	if (n != 0x554D4551)	// "QEMU"
+		return;
+	outw(FW_CFG_SEL, FW_CFG_ID);
+	insb(FW_CFG_DATA, &n, 4);
+	if (!(n & FW_CFG_ID_DMA))
+		return;
+
+	outw(FW_CFG_SEL, FW_CFG_FILE_DIR);
+	insb(FW_CFG_DATA, &n, 4);
+	for (n = bswap(n); n > 0; n--) {
+		insb(FW_CFG_DATA, &f, sizeof(f));
+		f.select = (f.select >> 8) | (f.select << 8);
+		if (streq(f.name, "opt/jos/kernel"))
+			fwcfg_kernel = f.select;
+		else if (streq(f.name, "opt/jos/initrd")) {
+			fwcfg_initrd = f.select;
+			initrd_size = bswap(f.size);
+		}
+	}
+}
+
+// Run one fw_cfg DMA operation and wait for it to finish.
+// Returns 0 on success, -1 if the device reported an error.
+static int
+fwcfg_dma(uint32_t control, uint32_t pa, uint32_t len)
+{
+	static volatile struct Fwcfg_dma dma;
+
+	dma.control = bswap(control);
+	dma.length = bswap(len);
+	dma.addr_hi = 0;
+	dma.addr_lo = bswap(pa);
+	// writing the low half of the descriptor address starts it
+	outl(FW_CFG_DMA, 0);
+	outl(FW_CFG_DMA + 4, bswap((uint32_t) &dma));
+	// the device clears every bit but the error bit when done
+	while ((control = bswap(dma.control)) & ~FW_CFG_DMA_ERROR)
+		/* do nothing */;
+	return (control & FW_CFG_DMA_ERROR) ? -1 : 0;
+}
+
+// Read 'count' bytes at 'offset' in fw_cfg item 'sel' to physical
+// address 'pa'.  Returns 0 on success, -1 on error.
+int
+fwcfg_read(uint16_t sel, uint32_t offset, uint32_t pa, uint32_t count)
+{
+	if (fwcfg_dma(sel << 16 | FW_CFG_DMA_SELECT | FW_CFG_DMA_SKIP,
+		      0, offset) < 0)
+		return -1;
+	return fwcfg_dma(FW_CFG_DMA_READ, pa, count);
+}
+
+static uint32_t
+pci_conf_read(uint32_t dev, uint32_t reg)
+{
+	outl(PCI_CONF_ADDR, 0x80000000 | dev | reg);
+	return inl(PCI_CONF_DATA);
+}
+
+static void
+pci_conf_write(uint32_t dev, uint32_t reg, uint32_t v)
+{
+	outl(PCI_CONF_ADDR, 0x80000000 | dev | reg);
+	outl(PCI_CONF_DATA, v);
+}
+
+// Look on PCI bus 0 for a bus-master capable IDE controller
+// and record its bus-master register base in 'bmide'.
+void
+bmide_init(void)
+{
+	uint32_t dev, class;
+
+	bmide = 0;
+	// 'dev' is the device/function part of a configuration address
+	for (dev = 0; dev < (32 << 11); dev += (1 << 8)) {
+		class = pci_conf_read(dev, PCI_CLASS);
+		// mass storage, IDE, prog-if says bus-master capable
+		if ((class >> 16) != 0x0101 || !(class & 0x8000))
+			continue;
+		class = pci_conf_read(dev, PCI_BAR4);
+		if (!(class & 1))	// must be an I/O space BAR
+			continue;
+		pci_conf_write(dev, PCI_CMD, pci_conf_read(dev, PCI_CMD)
+			       | PCI_CMD_IO | PCI_CMD_MASTER);
+		bmide = class & 0xFFFC;
+		return;
 	}
 }
 
@@ -103,23 +463,80 @@ waitdisk(void)
 		/* do nothing */;
 }
 
-void
-readsect(void *dst, uint32_t offset)
+// Issue ATA command 'cmd' for 'nsect' sectors at LBA 'offset'
+static void
+disk_cmd(uint32_t offset, uint32_t nsect, uint8_t cmd)
 {
 	// wait for disk to be ready
 	waitdisk();
 
-	outb(0x1F2, 1);		// count = 1
+	outb(0x1F2, nsect);
 	outb(0x1F3, offset);
 	outb(0x1F4, offset >> 8);
 	outb(0x1F5, offset >> 16);
 	outb(0x1F6, (offset >> 24) | 0xE0);
-	outb(0x1F7, 0x20);	// cmd 0x20 - read sectors
+	outb(0x1F7, cmd);
+}
+
+// Have the bus-master controller stream 'nsect' sectors at 'offset'
+// straight into physical address 'dst'.  Returns 0 on success, -1 if
+// the transfer failed and the caller should fall back to PIO.
+static int
+readsects_dma(void *dst, uint32_t offset, uint32_t nsect)
+{
+	uint32_t pa, end, next;
+	struct Prd *prd;
+	uint8_t status;
+
+	// split the buffer at 64KB boundaries
+	pa = (uint32_t) dst;
+	end = pa + nsect * SECTSIZE;
+	for (prd = prdt; pa < end; prd++) {
+		next = (pa + 0x10000) & ~0xFFFF;
+		if (next > end)
+			next = end;
+		prd->addr = pa;
+		prd->count = next - pa;
+		prd->flags = 0;
+		pa = next;
+	}
+	prd[-1].flags = PRD_EOT;
+
+	outl(bmide + BM_PRDT, (uint32_t) prdt);
+	outb(bmide + BM_CMD, BM_CMD_READ);
+	outb(bmide + BM_STATUS,
+	     inb(bmide + BM_STATUS) | BM_STATUS_ERR | BM_STATUS_IRQ);
+
+	disk_cmd(offset, nsect, 0xC8);	// cmd 0xC8 - read DMA
+	outb(bmide + BM_CMD, BM_CMD_READ | BM_CMD_START);
+
+	// interrupts are off; poll for the drive's completion interrupt
+	while (!((status = inb(bmide + BM_STATUS))
+		 & (BM_STATUS_ERR | BM_STATUS_IRQ)))
+		/* do nothing */;
+	outb(bmide + BM_CMD, 0);
 
-	// wait for disk to be ready
 	waitdisk();
+	if ((status & BM_STATUS_ERR) || (inb(0x1F7) & 0x21))
+		return -1;
+	return 0;
+}
 
-	// read a sector
-	insl(0x1F0, dst, SECTSIZE/4);
+// Read 'nsect' consecutive sectors starting at sector 'offset' into 'dst'
+// using a single disk command.  nsect must be in [1, MAXSECTS].
+void
+readsects(void *dst, uint32_t offset, uint32_t nsect)
+{
+	if (bmide && readsects_dma(dst, offset, nsect) == 0)
+		return;
+
+	disk_cmd(offset, nsect, 0x20);	// cmd 0x20 - read sectors
+
+	// the drive raises DRQ once per sector; drain each block as it lands
+	while (nsect-- > 0) {
+		waitdisk();
+		insl(0x1F0, dst, SECTSIZE/4);
+		dst = (uint8_t*) dst + SECTSIZE;
+	}
 }
 
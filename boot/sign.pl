@@ -2,20 +2,28 @@
 
 open(BB, $ARGV[0]) || die "open $ARGV[0]: $!";
 
+# The loader spans $ARGV[1] sectors; boot.S places the
+# boot sector signature at the end of the first one.
+my $max = ($ARGV[1] || 1) * 512;
+
 binmode BB;
 my $buf;
-read(BB, $buf, 1000);
+read(BB, $buf, $max + 1);
 $n = length($buf);
 
-if($n > 510){
-	print STDERR "boot block too large: $n bytes (max 510)\n";
+if($n > $max){
+	print STDERR "boot loader too large: $n bytes (max $max)\n";
+	exit 1;
+}
+
+if($n < 512 || substr($buf, 510, 2) ne "\x55\xAA"){
+	print STDERR "boot sector signature missing\n";
 	exit 1;
 }
 
-print STDERR "boot block is $n bytes (max 510)\n";
+print STDERR "boot loader is $n bytes (max $max)\n";
 
-$buf .= "\0" x (510-$n);
-$buf .= "\x55\xAA";
+$buf .= "\0" x ($max-$n);
 
 open(BB, ">$ARGV[0]") || die "open >$ARGV[0]: $!";
 binmode BB;
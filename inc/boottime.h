@@ -0,0 +1,40 @@
+#ifndef JOS_INC_BOOTTIME_H
+#define JOS_INC_BOOTTIME_H
+
+/*
+ * Boot-phase timeline.  The boot loader and the early kernel record
+ * read_tsc() at each milestone into a small record at a fixed physical
+ * address in free low memory, which the kernel monitor can print
+ * ('boottime').  The record is only valid if boot/main.c stamped it
+ * with BOOTTIME_MAGIC; another loader (e.g., GRUB) leaves it alone.
+ */
+
+#define BOOTTIME_PA	0x500		// just past the BIOS data area
+#define BOOTTIME_MAGIC	0x54425442	// "BTBT"
+
+// Timestamp slots
+#define BT_START	0	// boot.S entry (still in real mode)
+#define BT_PROT		1	// boot.S switched to protected mode
+#define BT_ENTRY	2	// kern/entry.S entry
+#define BT_BSS		3	// i386_init() cleared BSS
+#define BT_CONS		4	// i386_init() initialized the console
+#define BT_SEG		5	// readseg() completions, ELF header first
+#define BT_NSEG		11
+#define BT_NSTAMP	(BT_SEG + BT_NSEG)
+
+// Physical address of timestamp slot 'i', for assembly code
+#define BOOTTIME_TSC(i)	(BOOTTIME_PA + 8 + 8 * (i))
+
+#ifndef __ASSEMBLER__
+
+#include <inc/types.h>
+
+struct Boottime {
+	uint32_t bt_magic;
+	uint32_t bt_nseg;		// readseg() slots used
+	uint64_t bt_tsc[BT_NSTAMP];	// 0 if the milestone wasn't reached
+};
+
+#endif /* !__ASSEMBLER__ */
+
+#endif /* !JOS_INC_BOOTTIME_H */
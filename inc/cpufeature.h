@@ -0,0 +1,53 @@
+#ifndef JOS_INC_CPUFEATURE_H
+#define JOS_INC_CPUFEATURE_H
+
+#include <inc/types.h>
+
+/*
+ * CPU features, probed once at boot with cpuid (lib/cpufeature.c).
+ * Code with several implementations of a routine (lib/string.c) picks
+ * one from these when it is initialized, and records its choice in a
+ * struct Dispatch table for the 'cpuinfo' monitor command.
+ */
+
+#define CPUF_FPU	0x0001	// x87 FPU on chip
+#define CPUF_PSE	0x0002	// 4MB pages
+#define CPUF_TSC	0x0004	// rdtsc
+#define CPUF_PGE	0x0008	// global pages
+#define CPUF_FXSR	0x0010	// fxsave/fxrstor
+#define CPUF_SSE	0x0020
+#define CPUF_SSE2	0x0040	// also movnti
+#define CPUF_SSE3	0x0080
+#define CPUF_SSSE3	0x0100
+#define CPUF_SSE41	0x0200
+#define CPUF_SSE42	0x0400
+#define CPUF_ERMS	0x0800	// enhanced rep movsb/stosb
+#define CPUF_INVTSC	0x1000	// TSC runs at a constant rate in all states
+#define CPUF_NFEATURES	13
+
+struct Cpu_features {
+	char cf_vendor[13];	// e.g., "GenuineIntel"
+	uint8_t cf_family;
+	uint8_t cf_model;
+	uint8_t cf_stepping;
+	uint32_t cf_flags;	// CPUF_*
+};
+
+extern struct Cpu_features cpu_features;
+extern const char *const cpu_feature_names[CPUF_NFEATURES];
+
+#define cpu_has(f)	((cpu_features.cf_flags & (f)) != 0)
+
+void	cpu_probe(void);
+
+// One routine and the implementation chosen for it
+struct Dispatch {
+	const char *routine;
+	const char *impl;
+};
+
+// lib/string.c; ends with a null entry
+extern struct Dispatch string_dispatch[];
+void	string_init(void);
+
+#endif /* !JOS_INC_CPUFEATURE_H */
@@ -47,6 +47,7 @@ struct Secthdr {
 
 // Values for Proghdr::p_type
 #define ELF_PROG_LOAD		1
+#define ELF_PROG_LOAD_LZ4	0x6a6f7301	// JOS: LOAD stored as an LZ4 block
 
 // Flag bits for Proghdr::p_flags
 #define ELF_PROG_FLAG_EXEC	1
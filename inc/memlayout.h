@@ -87,6 +87,13 @@
 #define IOPHYSMEM	0x0A0000
 #define EXTPHYSMEM	0x100000
 
+// The boot loader (boot/boot.S and boot/main.c, with its stack below it)
+// stays resident in physical [BOOTLOADER, BOOTLOADER_END), so that the
+// monitor's 'kexec' can reenter it at BOOTREENTRY to reload the kernel.
+#define BOOTLOADER	0x007000
+#define BOOTLOADER_END	0x009000
+#define BOOTREENTRY	0x007E00
+
 // Virtual page table.  Entry PDX[VPT] in the PD contains a pointer to
 // the page directory itself, thereby turning the PD into a page table,
 // which maps all the PTEs containing the page mappings for the entire
@@ -165,11 +172,13 @@ extern volatile pde_t vpd[];     // VA of current page directory
  * You can map a Page * to the corresponding physical address
  * with page2pa() in kern/pmap.h.
  */
-LIST_HEAD(Page_list, Page);
-typedef LIST_ENTRY(Page) Page_LIST_entry_t;
-
 struct Page {
-	Page_LIST_entry_t pp_link;	/* free list link */
+	// Free list links, as page numbers rather than pointers to keep
+	// the array small (8 bytes a page).  Physical page 0 is never
+	// free, so 0 ends a list; memory above 256MB is never used, so
+	// every page number fits in 16 bits.
+	uint16_t pp_next;
+	uint16_t pp_prev;
 
 	// pp_ref is the count of pointers (usually in page table entries)
 	// to this page, for pages allocated using page_alloc.
@@ -177,7 +186,15 @@ struct Page {
 	// boot_alloc do not have valid reference count fields.
 
 	uint16_t pp_ref;
+
+	// The first page of a buddy allocator block, free or allocated,
+	// records that the block is 2^pp_order pages long; PP_FREE is
+	// set while the block is free.
+	uint8_t pp_order;
+	uint8_t pp_flags;
 };
 
+#define PP_FREE		0x01	/* heads a free buddy block */
+
 #endif /* !__ASSEMBLER__ */
 #endif /* !JOS_INC_MEMLAYOUT_H */
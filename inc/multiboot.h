@@ -0,0 +1,82 @@
+#ifndef JOS_INC_MULTIBOOT_H
+#define JOS_INC_MULTIBOOT_H
+
+/*
+ * Definitions from the Multiboot specification (version 0.6.96) that
+ * JOS uses.  GRUB hands the kernel a Multiboot information structure,
+ * and boot/main.c builds an equivalent one, so the kernel can size
+ * physical memory from the BIOS memory map without probing.
+ */
+
+// In the kernel image's Multiboot header
+#define MULTIBOOT_HEADER_MAGIC		0x1BADB002
+#define MULTIBOOT_PAGE_ALIGN		0x00000001	// align modules
+#define MULTIBOOT_MEMORY_INFO		0x00000002	// want memory info
+
+// In %eax at kernel entry, with %ebx pointing at the info structure
+#define MULTIBOOT_BOOTLOADER_MAGIC	0x2BADB002
+
+// Multiboot_info::flags bits
+#define MULTIBOOT_INFO_MEMORY		0x00000001	// mem_lower/mem_upper
+#define MULTIBOOT_INFO_MODS		0x00000008	// mods_*
+#define MULTIBOOT_INFO_MEM_MAP		0x00000040	// mmap_*
+
+// Multiboot_mmap::type
+#define MULTIBOOT_MEMORY_AVAILABLE	1
+
+// Where boot/main.c builds its Multiboot information, in page 0.
+// boot.S stores the E820 map at MULTIBOOT_MMAP_PA, preceded by its
+// length in bytes.
+#define MULTIBOOT_INFO_PA		0x600
+#define MULTIBOOT_MODS_PA		0x680
+#define MULTIBOOT_MMAP_PA		0x700
+#define MULTIBOOT_MMAP_MAX		(32 * 24)	// bytes of entries
+
+#ifndef __ASSEMBLER__
+
+#include <inc/types.h>
+
+struct Multiboot_info {
+	uint32_t flags;
+	uint32_t mem_lower;		// KB of memory from 0
+	uint32_t mem_upper;		// KB of memory from 1MB
+	uint32_t boot_device;
+	uint32_t cmdline;
+	uint32_t mods_count;
+	uint32_t mods_addr;
+	uint32_t syms[4];
+	uint32_t mmap_length;		// bytes of memory map
+	uint32_t mmap_addr;		// physical address of memory map
+	uint32_t drives_length;
+	uint32_t drives_addr;
+	uint32_t config_table;
+	uint32_t boot_loader_name;
+	uint32_t apm_table;
+	uint32_t vbe_control_info;
+	uint32_t vbe_mode_info;
+	uint16_t vbe_mode;
+	uint16_t vbe_interface_seg;
+	uint16_t vbe_interface_off;
+	uint16_t vbe_interface_len;
+};
+
+// One boot module (e.g., an initial ramdisk)
+struct Multiboot_mod {
+	uint32_t mod_start;		// physical address
+	uint32_t mod_end;
+	uint32_t string;
+	uint32_t reserved;
+};
+
+// One memory map entry.  'size' counts the bytes after itself,
+// so the next entry is at (char *) entry + entry->size + 4.
+struct Multiboot_mmap {
+	uint32_t size;
+	uint64_t addr;
+	uint64_t len;
+	uint32_t type;
+} __attribute__((packed));
+
+#endif /* !__ASSEMBLER__ */
+
+#endif /* !JOS_INC_MULTIBOOT_H */
@@ -1,6 +1,7 @@
 #ifndef JOS_INC_STDIO_H
 #define JOS_INC_STDIO_H
 
+#include <inc/types.h>
 #include <inc/stdarg.h>
 
 #ifndef NULL
@@ -12,6 +13,9 @@ void	cputchar(int c);
 int	getchar(void);
 int	iscons(int fd);
 
+// kern/console.c (kernel only)
+void	cons_write(const char *buf, size_t n);
+
 // lib/printfmt.c
 void	printfmt(void (*putch)(int, void*), void *putdat, const char *fmt, ...);
 void	vprintfmt(void (*putch)(int, void*), void *putdat, const char *fmt, va_list);
@@ -14,10 +14,14 @@ char *	strchr(const char *s, char c);
 char *	strfind(const char *s, char c);
 
 void *	memset(void *dst, int c, size_t len);
-/* no memcpy - use memmove instead */
+void *	memset16(void *dst, uint16_t c, size_t n);
+void *	memset32(void *dst, uint32_t c, size_t n);
+void *	memcpy(void *dst, const void *src, size_t len);
 void *	memmove(void *dst, const void *src, size_t len);
 int	memcmp(const void *s1, const void *s2, size_t len);
 void *	memfind(const void *s, int c, size_t len);
+void *	memzero_nt(void *dst, size_t len);
+void *	memcpy_nt(void *dst, const void *src, size_t len);
 
 long	strtol(const char *s, char **endptr, int base);
 
@@ -28,6 +28,7 @@ static __inline uint32_t rcr3(void) __attribute__((always_inline));
 static __inline void lcr4(uint32_t val) __attribute__((always_inline));
 static __inline uint32_t rcr4(void) __attribute__((always_inline));
 static __inline void tlbflush(void) __attribute__((always_inline));
+static __inline void clts(void) __attribute__((always_inline));
 static __inline uint32_t read_eflags(void) __attribute__((always_inline));
 static __inline void write_eflags(uint32_t eflags) __attribute__((always_inline));
 static __inline uint32_t read_ebp(void) __attribute__((always_inline));
@@ -219,6 +220,12 @@ tlbflush(void)
 	__asm __volatile("movl %0,%%cr3" : : "r" (cr3));
 }
 
+static __inline void
+clts(void)
+{
+	__asm __volatile("clts");
+}
+
 static __inline uint32_t
 read_eflags(void)
 {
@@ -255,7 +262,7 @@ cpuid(uint32_t info, uint32_t *eaxp, uint32_t *ebxp, uint32_t *ecxp, uint32_t *e
 	uint32_t eax, ebx, ecx, edx;
 	asm volatile("cpuid" 
 		: "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
-		: "a" (info));
+		: "a" (info), "c" (0));		// subleaf 0 where it matters
 	if (eaxp)
 		*eaxp = eax;
 	if (ebxp)
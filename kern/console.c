@@ -7,9 +7,9 @@
 #include <inc/assert.h>
 
 #include <kern/console.h>
+#include <kern/pmap.h>
 
 static void cons_intr(int (*proc)(void));
-static void cons_putc(int c);
 
 // Stupid I/O delay routine necessitated by historical PC design flaws
 static void
@@ -25,14 +25,29 @@ delay(void)
 
 #define COM1		0x3F8
 
+// Line speed; build with 'make DEFS=-DCOM_BAUD=9600' (say) to change it
+#ifndef COM_BAUD
+#define COM_BAUD	115200
+#endif
+
 #define COM_RX		0	// In:	Receive buffer (DLAB=0)
 #define COM_TX		0	// Out: Transmit buffer (DLAB=0)
 #define COM_DLL		0	// Out: Divisor Latch Low (DLAB=1)
 #define COM_DLM		1	// Out: Divisor Latch High (DLAB=1)
 #define COM_IER		1	// Out: Interrupt Enable Register
 #define   COM_IER_RDI	0x01	//   Enable receiver data interrupt
+#define   COM_IER_TXRI	0x02	//   Enable transmitter empty interrupt
 #define COM_IIR		2	// In:	Interrupt ID Register
+#define   COM_IIR_FIFO	0xC0	//   FIFOs enabled and working (16550A)
 #define COM_FCR		2	// Out: FIFO Control Register
+#define   COM_FCR_ENABLE 0x01	//   Enable the RX and TX FIFOs
+#define   COM_FCR_RXRESET 0x02	//   Clear the RX FIFO
+#define   COM_FCR_TXRESET 0x04	//   Clear the TX FIFO
+#define   COM_FCR_TRIG1	0x00	//   RX interrupt at 1 byte in the FIFO
+#define   COM_FCR_TRIG4	0x40	//   ... 4 bytes
+#define   COM_FCR_TRIG8	0x80	//   ... 8 bytes
+#define   COM_FCR_TRIG14 0xC0	//   ... 14 bytes
+#define COM_FIFOSIZE	16	// Bytes in a 16550A transmit FIFO
 #define COM_LCR		3	// Out: Line Control Register
 #define	  COM_LCR_DLAB	0x80	//   Divisor latch access bit
 #define	  COM_LCR_WLEN8	0x03	//   Wordlength: 8 bits
@@ -47,6 +62,22 @@ delay(void)
 
 static bool serial_exists;
 
+// Output waiting for the UART.  serial_putc() only appends here, and the
+// ring is drained whenever the transmitter has room: from the THRE
+// interrupt once IRQ 4 is wired up, and until then from serial_intr(),
+// which cons_getc() polls while the kernel waits for input.
+#define SERTXBUFSIZE 4096
+
+static struct {
+	uint8_t buf[SERTXBUFSIZE];
+	uint32_t rpos;
+	uint32_t wpos;
+} sertx;
+
+static uint8_t serial_ier;	// current COM_IER value
+static int serial_txfifo;	// bytes the UART takes per TXRDY
+static bool serial_sync;	// write through; set once we panic
+
 static int
 serial_proc_data(void)
 {
@@ -55,51 +86,145 @@ serial_proc_data(void)
 	return inb(COM1+COM_RX);
 }
 
+// Wait (boundedly) for the transmitter to take another byte
+static void
+serial_wait_txrdy(void)
+{
+	int i;
+
+	for (i = 0;
+	     !(inb(COM1 + COM_LSR) & COM_LSR_TXRDY) && i < 12800;
+	     i++)
+		delay();
+}
+
+// Send as many queued bytes as the UART can take once TXRDY is set:
+// with the FIFO on, TXRDY means the whole transmit FIFO is empty.
+static void
+serial_tx_burst(void)
+{
+	int n;
+
+	for (n = 0; n < serial_txfifo && sertx.rpos != sertx.wpos; n++) {
+		outb(COM1 + COM_TX, sertx.buf[sertx.rpos++]);
+		if (sertx.rpos == SERTXBUFSIZE)
+			sertx.rpos = 0;
+	}
+}
+
+// Feed the UART as much queued output as it will take without waiting,
+// and ask for a THRE interrupt only while more remains.
+static void
+serial_tx_drain(void)
+{
+	uint8_t ier;
+
+	while (sertx.rpos != sertx.wpos
+	       && (inb(COM1 + COM_LSR) & COM_LSR_TXRDY))
+		serial_tx_burst();
+
+	ier = COM_IER_RDI | (sertx.rpos != sertx.wpos ? COM_IER_TXRI : 0);
+	if (ier != serial_ier)
+		outb(COM1 + COM_IER, serial_ier = ier);
+}
+
+// Send everything queued, waiting on the UART as necessary
+static void
+serial_flush(void)
+{
+	while (sertx.rpos != sertx.wpos) {
+		serial_wait_txrdy();
+		serial_tx_burst();
+	}
+}
+
 void
 serial_intr(void)
 {
-	if (serial_exists)
+	if (serial_exists) {
 		cons_intr(serial_proc_data);
+		serial_tx_drain();
+	}
+}
+
+// Bytes free in the TX ring; one slot stays empty to tell full from empty
+static size_t
+serial_tx_space(void)
+{
+	return (sertx.rpos + SERTXBUFSIZE - sertx.wpos - 1) % SERTXBUFSIZE;
 }
 
 static void
-serial_putc(int c)
+serial_write(const char *buf, size_t n)
 {
-	int i;
-	
-	for (i = 0;
-	     !(inb(COM1 + COM_LSR) & COM_LSR_TXRDY) && i < 12800;
-	     i++)
-		delay();
-	
-	outb(COM1 + COM_TX, c);
+	size_t m;
+
+	if (!serial_exists)
+		return;
+
+	while (n > 0) {
+		// Full: make room at line speed rather than drop output
+		if (serial_tx_space() == 0) {
+			serial_tx_drain();
+			if (serial_tx_space() == 0) {
+				serial_wait_txrdy();
+				serial_tx_burst();
+			}
+		}
+		m = MIN(MIN(n, serial_tx_space()), SERTXBUFSIZE - sertx.wpos);
+		memcpy(sertx.buf + sertx.wpos, buf, m);
+		sertx.wpos += m;
+		if (sertx.wpos == SERTXBUFSIZE)
+			sertx.wpos = 0;
+		buf += m;
+		n -= m;
+	}
+
+	if (serial_sync)
+		serial_flush();
+	else
+		serial_tx_drain();
 }
 
 static void
 serial_init(void)
 {
-	// Turn off the FIFO
-	outb(COM1+COM_FCR, 0);
+	// Turn on and clear the FIFOs.  Input is polled for now, but
+	// once IRQ 4 is wired up an 8-byte trigger (plus the receiver's
+	// timeout interrupt for stragglers) keeps interrupts per byte low.
+	outb(COM1+COM_FCR, COM_FCR_ENABLE | COM_FCR_RXRESET | COM_FCR_TXRESET
+	     | COM_FCR_TRIG8);
 	
 	// Set speed; requires DLAB latch
 	outb(COM1+COM_LCR, COM_LCR_DLAB);
-	outb(COM1+COM_DLL, (uint8_t) (115200 / 9600));
-	outb(COM1+COM_DLM, 0);
+	outb(COM1+COM_DLL, (uint8_t) (115200 / COM_BAUD));
+	outb(COM1+COM_DLM, (uint8_t) ((115200 / COM_BAUD) >> 8));
 
 	// 8 data bits, 1 stop bit, parity off; turn off DLAB latch
 	outb(COM1+COM_LCR, COM_LCR_WLEN8 & ~COM_LCR_DLAB);
 
 	// No modem controls
 	outb(COM1+COM_MCR, 0);
-	// Enable rcv interrupts
-	outb(COM1+COM_IER, COM_IER_RDI);
+	// Enable rcv interrupts; serial_tx_drain() adds THRE interrupts
+	// while there is output queued
+	serial_ier = COM_IER_RDI;
+	outb(COM1+COM_IER, serial_ier);
 
 	// Clear any preexisting overrun indications and interrupts
 	// Serial port doesn't exist if COM_LSR returns 0xFF
 	serial_exists = (inb(COM1+COM_LSR) != 0xFF);
-	(void) inb(COM1+COM_IIR);
 	(void) inb(COM1+COM_RX);
 
+	// An 8250 or 16450 has no FIFO, and the 16550's is broken; only
+	// a 16550A reports both FIFO bits set.  Otherwise send a byte at
+	// a time.
+	if ((inb(COM1+COM_IIR) & COM_IIR_FIFO) == COM_IIR_FIFO)
+		serial_txfifo = COM_FIFOSIZE;
+	else {
+		outb(COM1+COM_FCR, 0);
+		serial_txfifo = 1;
+	}
+
 }
 
 
@@ -120,6 +245,13 @@ lpt_putc(int c)
 	outb(0x378+2, 0x08);
 }
 
+static void
+lpt_write(const char *buf, size_t n)
+{
+	while (n-- > 0)
+		lpt_putc(*buf++);
+}
+
 
 
 
@@ -129,12 +261,53 @@ static unsigned addr_6845;
 static uint16_t *crt_buf;
 static uint16_t crt_pos;
 
+// The screen is a CRT_SIZE view into a larger window of video memory,
+// starting at cell crt_origin, and scrolling just moves the view down
+// a row by reprogramming the 6845's start address.  Only when the view
+// reaches the end of the window is the screen copied back to the top.
+// A monochrome adapter may have only a screen's worth of memory, so
+// there the window is the screen and every scroll copies.
+static uint16_t crt_window;		// usable cells of video memory
+static uint16_t crt_origin;		// first cell on the screen
+
+// cga_putc() draws into a copy of the window in ordinary memory and
+// notes which cells changed.  cga_flush() then copies just those cells
+// to video memory and moves the cursor, once per write, since under
+// emulation every access to the device costs far more than to RAM.
+static uint16_t crt_shadow[CGA_WINDOW];
+static uint16_t crt_dirty_lo;		// changed cells are [lo, hi)
+static uint16_t crt_dirty_hi;
+static uint16_t crt_start;		// where the 6845 starts the screen
+static uint16_t crt_cursor;		// where the 6845 has the cursor
+
+// Read or write a 16-bit 6845 register pair, high byte in 'reg'
+static unsigned
+crtc_get(int reg)
+{
+	unsigned v;
+
+	outb(addr_6845, reg);
+	v = inb(addr_6845 + 1) << 8;
+	outb(addr_6845, reg + 1);
+	v |= inb(addr_6845 + 1);
+	return v;
+}
+
+static void
+crtc_set(int reg, uint16_t v)
+{
+	// A word write to the index port sets the register
+	// (low byte) and its value (high byte) together
+	outw(addr_6845, reg | (v & 0xFF00));
+	outw(addr_6845, (reg + 1) | (v << 8));
+}
+
 static void
 cga_init(void)
 {
 	volatile uint16_t *cp;
 	uint16_t was;
-	unsigned pos;
+	unsigned start, pos;
 
 	cp = (uint16_t*) (KERNBASE + CGA_BUF);
 	was = *cp;
@@ -142,26 +315,47 @@ cga_init(void)
 	if (*cp != 0xA55A) {
 		cp = (uint16_t*) (KERNBASE + MONO_BUF);
 		addr_6845 = MONO_BASE;
+		crt_window = CRT_SIZE;
 	} else {
 		*cp = was;
 		addr_6845 = CGA_BASE;
+		crt_window = CGA_WINDOW;
 	}
 	
-	/* Extract cursor location */
-	outb(addr_6845, 14);
-	pos = inb(addr_6845 + 1) << 8;
-	outb(addr_6845, 15);
-	pos |= inb(addr_6845 + 1);
+	/* Extract screen start and cursor location; a kernel we were
+	   kexec'ed from may have left the screen scrolled */
+	start = crtc_get(12);
+	if (start + CRT_SIZE > crt_window)
+		start = 0;
+	pos = crtc_get(14) - start;
+	if (pos >= CRT_SIZE)
+		pos = CRT_SIZE - CRT_COLS;
 
 	crt_buf = (uint16_t*) cp;
 	crt_pos = pos;
+	crt_start = start;
+	crt_cursor = start + pos;
+
+	// Start from whatever was on the screen, moved to the top of
+	// the window by the first flush
+	memmove(crt_shadow, crt_buf + start, CRT_SIZE * sizeof(uint16_t));
+	crt_origin = 0;
+	crt_dirty_lo = 0;
+	crt_dirty_hi = CRT_SIZE;
 }
 
-
+static void
+cga_dirty(uint16_t lo, uint16_t hi)
+{
+	crt_dirty_lo = MIN(crt_dirty_lo, lo);
+	crt_dirty_hi = MAX(crt_dirty_hi, hi);
+}
 
 static void
 cga_putc(int c)
 {
+	uint16_t *screen = crt_shadow + crt_origin;
+
 	// if no attribute given, then use black on white
 	if (!(c & ~0xFF))
 		c |= 0x0700;
@@ -170,7 +364,8 @@ cga_putc(int c)
 	case '\b':
 		if (crt_pos > 0) {
 			crt_pos--;
-			crt_buf[crt_pos] = (c & ~0xff) | ' ';
+			screen[crt_pos] = (c & ~0xff) | ' ';
+			cga_dirty(crt_origin + crt_pos, crt_origin + crt_pos + 1);
 		}
 		break;
 	case '\n':
@@ -180,32 +375,68 @@ cga_putc(int c)
 		crt_pos -= (crt_pos % CRT_COLS);
 		break;
 	case '\t':
-		cons_putc(' ');
-		cons_putc(' ');
-		cons_putc(' ');
-		cons_putc(' ');
-		cons_putc(' ');
+		cga_putc(' ');
+		cga_putc(' ');
+		cga_putc(' ');
+		cga_putc(' ');
+		cga_putc(' ');
 		break;
 	default:
-		crt_buf[crt_pos++] = c;		/* write the character */
+		cga_dirty(crt_origin + crt_pos, crt_origin + crt_pos + 1);
+		screen[crt_pos++] = c;		/* write the character */
 		break;
 	}
 
-	// What is the purpose of this?
+	// Scroll: move the screen down the window a row, or if it is at
+	// the end, copy all but the top row back to the start.  Anything
+	// still dirty is then off the screen.
 	if (crt_pos >= CRT_SIZE) {
-		int i;
-
-		memmove(crt_buf, crt_buf + CRT_COLS, (CRT_SIZE - CRT_COLS) * sizeof(uint16_t));
-		for (i = CRT_SIZE - CRT_COLS; i < CRT_SIZE; i++)
-			crt_buf[i] = 0x0700 | ' ';
+		if (crt_origin + CRT_SIZE + CRT_COLS <= crt_window)
+			crt_origin += CRT_COLS;
+		else {
+			memmove(crt_shadow, screen + CRT_COLS, (CRT_SIZE - CRT_COLS) * sizeof(uint16_t));
+			crt_origin = 0;
+			crt_dirty_lo = CGA_WINDOW;
+			crt_dirty_hi = 0;
+			cga_dirty(0, CRT_SIZE - CRT_COLS);
+		}
+		memset16(crt_shadow + crt_origin + CRT_SIZE - CRT_COLS, 0x0700 | ' ', CRT_COLS);
+		cga_dirty(crt_origin + CRT_SIZE - CRT_COLS, crt_origin + CRT_SIZE);
 		crt_pos -= CRT_COLS;
 	}
+}
+
+// Copy changed cells to video memory, then show them: point the 6845
+// at the screen's new origin and move the cursor, if either changed
+static void
+cga_flush(void)
+{
+	if (crt_dirty_lo < crt_dirty_hi) {
+		// display memory is write-mostly; don't pull it into the cache
+		memcpy_nt(crt_buf + crt_dirty_lo, crt_shadow + crt_dirty_lo,
+			  (crt_dirty_hi - crt_dirty_lo) * sizeof(uint16_t));
+		crt_dirty_lo = CGA_WINDOW;
+		crt_dirty_hi = 0;
+	}
+
+	if (crt_start != crt_origin) {
+		crtc_set(12, crt_origin);
+		crt_start = crt_origin;
+	}
 
 	/* move that little blinky thing */
-	outb(addr_6845, 14);
-	outb(addr_6845 + 1, crt_pos >> 8);
-	outb(addr_6845, 15);
-	outb(addr_6845 + 1, crt_pos);
+	if (crt_cursor != crt_origin + crt_pos) {
+		crtc_set(14, crt_origin + crt_pos);
+		crt_cursor = crt_origin + crt_pos;
+	}
+}
+
+static void
+cga_write(const char *buf, size_t n)
+{
+	while (n-- > 0)
+		cga_putc((uint8_t) *buf++);
+	cga_flush();
 }
 
 
@@ -424,13 +655,14 @@ cons_getc(void)
 	return 0;
 }
 
-// output a character to the console
-static void
-cons_putc(int c)
+// output a span of characters to the console, each device taking
+// all of it at once
+void
+cons_write(const char *buf, size_t n)
 {
-	serial_putc(c);
-	lpt_putc(c);
-	cga_putc(c);
+	serial_write(buf, n);
+	lpt_write(buf, n);
+	cga_write(buf, n);
 }
 
 // initialize the console devices
@@ -445,13 +677,43 @@ cons_init(void)
 		cprintf("Serial port does not exist!\n");
 }
 
+// push out any console output still queued for the serial port
+void
+cons_flush(void)
+{
+	int i;
+
+	if (!serial_exists)
+		return;
+	serial_flush();
+	// and out of the FIFO, which serial_init() would otherwise clear
+	for (i = 0; !(inb(COM1 + COM_LSR) & COM_LSR_TSRE) && i < 12800; i++)
+		delay();
+}
+
+// flush, and write all further output synchronously.  For panic,
+// which may never get back to a point where the queue is drained.
+void
+cons_sync(void)
+{
+	serial_sync = 1;
+	cons_flush();
+}
+
 
 // `High'-level console I/O.  Used by readline and cprintf.
 
 void
 cputchar(int c)
 {
-	cons_putc(c);
+	char ch = c;
+
+	// Like cons_write(), except that the CGA display also gets the
+	// colour attribute that may be in the high byte of 'c'
+	serial_write(&ch, 1);
+	lpt_write(&ch, 1);
+	cga_putc(c);
+	cga_flush();
 }
 
 int
@@ -459,8 +721,9 @@ getchar(void)
 {
 	int c;
 
+	// While we wait, get some pages zeroed ahead of time
 	while ((c = cons_getc()) == 0)
-		/* do nothing */;
+		page_zero_idle();
 	return c;
 }
 
@@ -16,9 +16,13 @@
 #define CRT_ROWS	25
 #define CRT_COLS	80
 #define CRT_SIZE	(CRT_ROWS * CRT_COLS)
+// Whole rows in the 32KB of color text memory at CGA_BUF
+#define CGA_WINDOW	(0x8000 / 2 / CRT_COLS * CRT_COLS)
 
 void cons_init(void);
 int cons_getc(void);
+void cons_flush(void);
+void cons_sync(void);
 
 void kbd_intr(void); // irq 1
 void serial_intr(void); // irq 4
@@ -0,0 +1,94 @@
+/* See COPYRIGHT for copyright information. */
+
+#include <inc/x86.h>
+#include <inc/mmu.h>
+#include <inc/assert.h>
+#include <inc/cpufeature.h>
+
+#include <kern/fpu.h>
+
+// The FPU registers hold the state of fpu_live (NULL for the kernel's
+// own).  CR0_TS stays clear: nothing handles #NM yet, so the first FPU
+// instruction after setting it would fault with nowhere to go.
+static struct Fpu_state *fpu_live;
+static struct Fpu_state fpu_initial;	// after fninit, for new owners
+static int fpu_depth;			// kernel_fpu_begin() nesting
+static bool fpu_fxsr;
+
+static void
+fpu_save(struct Fpu_state *fs)
+{
+	if (fpu_fxsr)
+		asm volatile("fxsave %0" : "=m" (*fs));
+	else
+		asm volatile("fnsave %0; fwait" : "=m" (*fs));
+}
+
+static void
+fpu_restore(struct Fpu_state *fs)
+{
+	if (fpu_fxsr)
+		asm volatile("fxrstor %0" : : "m" (*fs));
+	else
+		asm volatile("frstor %0" : : "m" (*fs));
+}
+
+// Enable the FPU and, with FXSR, SSE, and record a clean state for
+// owners that haven't used the FPU yet
+void
+fpu_init(void)
+{
+	uint32_t cr0;
+
+	fpu_fxsr = cpu_has(CPUF_FXSR);
+
+	// MP: wait/fwait honor TS too; NE: report x87 errors as #MF
+	cr0 = rcr0() & ~(CR0_EM | CR0_TS);
+	lcr0(cr0 | CR0_MP | CR0_NE);
+	if (fpu_fxsr && cpu_has(CPUF_SSE))
+		lcr4(rcr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+
+	asm volatile("fninit");
+	fpu_save(&fpu_initial);
+	fpu_live = NULL;
+	fpu_depth = 0;
+}
+
+// Give 'fs' the clean state a new owner starts with
+void
+fpu_state_init(struct Fpu_state *fs)
+{
+	*fs = fpu_initial;
+}
+
+void
+kernel_fpu_begin(void)
+{
+	if (fpu_depth++ > 0)
+		return;
+	// Keep the owner's registers safe from kernel scratch use
+	if (fpu_live)
+		fpu_save(fpu_live);
+}
+
+void
+kernel_fpu_end(void)
+{
+	assert(fpu_depth > 0);
+	if (--fpu_depth > 0)
+		return;
+	if (fpu_live)
+		fpu_restore(fpu_live);
+}
+
+void
+fpu_switch(struct Fpu_state *fs)
+{
+	assert(fpu_depth == 0);
+	if (fs == fpu_live)
+		return;
+	if (fpu_live)
+		fpu_save(fpu_live);
+	fpu_restore(fs ? fs : &fpu_initial);
+	fpu_live = fs;
+}
@@ -0,0 +1,31 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_FPU_H
+#define JOS_KERN_FPU_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+// Saved x87/MMX/SSE register state, in fxsave format (or fnsave's,
+// which fits, on CPUs without FXSR)
+struct Fpu_state {
+	uint8_t fs_regs[512];
+} __attribute__((__aligned__(16)));
+
+void	fpu_init(void);
+void	fpu_state_init(struct Fpu_state *fs);
+
+// Bracket kernel code that uses x87, MMX or SSE registers.  The
+// sections nest, and must not be entered from an interrupt handler.
+void	kernel_fpu_begin(void);
+void	kernel_fpu_end(void);
+
+// Make 'fs' (NULL for the kernel's own, initial state) the state in
+// the FPU registers, saving the previous owner's first.  The switch is
+// eager: there is no #NM handler yet to defer it to first use, so CR0_TS
+// is never left set.
+void	fpu_switch(struct Fpu_state *fs);
+
+#endif /* !JOS_KERN_FPU_H */
@@ -3,9 +3,16 @@
 #include <inc/stdio.h>
 #include <inc/string.h>
 #include <inc/assert.h>
+#include <inc/x86.h>
+#include <inc/memlayout.h>
+#include <inc/boottime.h>
+#include <inc/cpufeature.h>
 
 #include <kern/monitor.h>
 #include <kern/console.h>
+#include <kern/pmap.h>
+#include <kern/slab.h>
+#include <kern/fpu.h>
 
 // Test the stack backtrace function (lab 1 only)
 void
@@ -19,22 +26,46 @@ test_backtrace(int x)
 	cprintf("leaving test_backtrace %d\n", x);
 }
 
+// Record a boot milestone, if our boot loader started a timeline
+static void
+boottime_stamp(int slot)
+{
+	struct Boottime *bt = (struct Boottime *) (KERNBASE + BOOTTIME_PA);
+
+	if (bt->bt_magic == BOOTTIME_MAGIC)
+		bt->bt_tsc[slot] = read_tsc();
+}
+
 void
 i386_init(void)
 {
 	extern char edata[], end[];
 
+	// Find out what the CPU can do, and pick the string routines
+	// to match, before they are first used.
+	cpu_probe();
+	string_init();
+
 	// Before doing anything else, complete the ELF loading process.
 	// Clear the uninitialized global data (BSS) section of our program.
 	// This ensures that all static/global variables start out zero.
 	memset(edata, 0, end - edata);
+	boottime_stamp(BT_BSS);
 
 	// Initialize the console.
 	// Can't call cprintf until after we do this!
 	cons_init();
+	boottime_stamp(BT_CONS);
+
+	// Enable the FPU and SSE for kernel_fpu_begin() sections.
+	fpu_init();
 
 	cprintf("6828 decimal is %o octal!\n", 6828);
 
+	// Lab 2 memory management initialization functions
+	mem_init();
+	slab_init();
+
 	// Test the stack backtrace function (lab 1 only)
 	test_backtrace(5);
 
@@ -66,6 +97,9 @@ _panic(const char *file, int line, const char *fmt,...)
 	// Be extra sure that the machine is in as reasonable state
 	__asm __volatile("cli; cld");
 
+	// Don't leave the message sitting in the serial output queue
+	cons_sync();
+
 	va_start(ap, fmt);
 	cprintf("kernel panic at %s:%d: ", file, line);
 	vcprintf(fmt, ap);
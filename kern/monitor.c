@@ -6,10 +6,13 @@
 #include <inc/memlayout.h>
 #include <inc/assert.h>
 #include <inc/x86.h>
+#include <inc/boottime.h>
+#include <inc/cpufeature.h>
 
 #include <kern/console.h>
 #include <kern/monitor.h>
 #include <kern/kdebug.h>
+#include <kern/pmap.h>
 
 #define CMDBUF_SIZE	80	// enough for one VGA text line
 
@@ -24,6 +27,11 @@ struct Command {
 static struct Command commands[] = {
 	{ "help", "Display this list of commands", mon_help },
 	{ "kerninfo", "Display information about the kernel", mon_kerninfo },
+	{ "boottime", "Display the boot-phase cycle breakdown", mon_boottime },
+	{ "cpuinfo", "Display CPU features and the routines chosen for them", mon_cpuinfo },
+	{ "buddyinfo", "Display free physical memory by block size", mon_buddyinfo },
+	{ "membench", "Compare bulk memory fill/copy speeds", mon_membench },
+	{ "kexec", "Reload the kernel from disk without a BIOS reset", mon_kexec },
 };
 #define NCOMMANDS (sizeof(commands)/sizeof(commands[0]))
 
@@ -56,6 +64,213 @@ mon_kerninfo(int argc, char **argv, struct Trapframe *tf)
 	return 0;
 }
 
+// Print one boot milestone: cycles since boot and since the last one
+static void
+boottime_row(const char *what, uint64_t t, uint64_t t0, uint64_t *prev)
+{
+	if (t == 0)
+		return;
+	cprintf("  %-24s%12llu  +%llu\n", what, t - t0, t - *prev);
+	*prev = t;
+}
+
+int
+mon_boottime(int argc, char **argv, struct Trapframe *tf)
+{
+	struct Boottime *bt = (struct Boottime *) (KERNBASE + BOOTTIME_PA);
+	uint64_t t0, prev;
+	char what[24];
+	int i;
+
+	if (bt->bt_magic != BOOTTIME_MAGIC) {
+		cprintf("No boot timeline (not booted by the JOS boot loader)\n");
+		return 0;
+	}
+
+	t0 = prev = bt->bt_tsc[BT_START];
+	cprintf("Boot timeline (TSC cycles)  %12s  phase\n", "total");
+	boottime_row("boot sector entry", bt->bt_tsc[BT_START], t0, &prev);
+	boottime_row("protected mode", bt->bt_tsc[BT_PROT], t0, &prev);
+	for (i = 0; i < bt->bt_nseg && i < BT_NSEG; i++) {
+		if (i == 0)
+			strcpy(what, "read ELF header");
+		else
+			snprintf(what, sizeof(what), "read segment %d", i - 1);
+		boottime_row(what, bt->bt_tsc[BT_SEG + i], t0, &prev);
+	}
+	boottime_row("kernel entry", bt->bt_tsc[BT_ENTRY], t0, &prev);
+	boottime_row("BSS cleared", bt->bt_tsc[BT_BSS], t0, &prev);
+	boottime_row("console initialized", bt->bt_tsc[BT_CONS], t0, &prev);
+	cprintf("  %-24s%12llu\n", "now", read_tsc() - t0);
+	return 0;
+}
+
+int
+mon_cpuinfo(int argc, char **argv, struct Trapframe *tf)
+{
+	struct Dispatch *d;
+	int i;
+
+	cprintf("%s family %d model %d stepping %d\n",
+		cpu_features.cf_vendor, cpu_features.cf_family,
+		cpu_features.cf_model, cpu_features.cf_stepping);
+	cprintf("Features:");
+	for (i = 0; i < CPUF_NFEATURES; i++)
+		if (cpu_has(1 << i))
+			cprintf(" %s", cpu_feature_names[i]);
+	cprintf("\n");
+	for (d = string_dispatch; d->routine; d++)
+		cprintf("  %-16s%s\n", d->routine, d->impl);
+	return 0;
+}
+
+int
+mon_buddyinfo(int argc, char **argv, struct Trapframe *tf)
+{
+	size_t blocks, total, larger;
+	int k;
+
+	total = 0;
+	for (k = 0; k <= PAGE_MAXORDER; k++)
+		total += page_free_blocks(k) << k;
+	if (total == 0) {
+		cprintf("No free memory\n");
+		return 0;
+	}
+
+	// A request for 2^k pages can only be met from blocks of at least
+	// that order; the rest of the free memory is unusable for it.
+	cprintf("order  block    free blocks  unusable\n");
+	larger = total;
+	for (k = 0; k <= PAGE_MAXORDER; k++) {
+		blocks = page_free_blocks(k);
+		cprintf("%5d  %4dK  %13u  %7u%%\n", k, (PGSIZE << k) / 1024,
+			blocks, (total - larger) * 100 / total);
+		larger -= blocks << k;
+	}
+	cprintf("%u pages (%uK) free\n", total, total * PGSIZE / 1024);
+	return 0;
+}
+
+// Run 'fn' on 'n' bytes a few times and print its best cycles per byte
+#define MEMBENCH_RUNS	4
+static void
+membench_col(void (*fn)(void *, void *, size_t),
+	     void *dst, void *src, size_t n)
+{
+	uint64_t t, best = ~0ULL;
+	uint32_t cpb;
+	int i;
+
+	for (i = 0; i < MEMBENCH_RUNS; i++) {
+		t = read_tsc();
+		fn(dst, src, n);
+		t = read_tsc() - t;
+		best = MIN(best, t);
+	}
+	cpb = (uint32_t) (best * 100 / n);
+	cprintf("  %8u.%02u", cpb / 100, cpb % 100);
+}
+
+static void
+bench_memset(void *dst, void *src, size_t n)
+{
+	memset(dst, 0, n);
+}
+
+static void
+bench_memzero_nt(void *dst, void *src, size_t n)
+{
+	memzero_nt(dst, n);
+}
+
+static void
+bench_memmove(void *dst, void *src, size_t n)
+{
+	memmove(dst, src, n);
+}
+
+static void
+bench_memcpy_nt(void *dst, void *src, size_t n)
+{
+	memcpy_nt(dst, src, n);
+}
+
+// One row of the table: every routine on buffers of 2^order pages
+static int
+membench_row(int order)
+{
+	struct Page *dst, *src;
+	void *d, *s;
+	size_t n;
+
+	if ((dst = page_alloc_order(order, 0)) == NULL)
+		return -1;
+	if ((src = page_alloc_order(order, 0)) == NULL) {
+		page_free_order(dst, order);
+		return -1;
+	}
+
+	d = page2kva(dst);
+	s = page2kva(src);
+	n = PGSIZE << order;
+	cprintf("%6uK", n / 1024);
+	membench_col(bench_memset, d, s, n);
+	membench_col(bench_memzero_nt, d, s, n);
+	membench_col(bench_memmove, d, s, n);
+	membench_col(bench_memcpy_nt, d, s, n);
+	cprintf("\n");
+
+	page_free_order(src, order);
+	page_free_order(dst, order);
+	return 0;
+}
+
+int
+mon_membench(int argc, char **argv, struct Trapframe *tf)
+{
+	int order, lo = 0, hi = PAGE_MAXORDER;
+
+	// Which of the cached and non-temporal routines wins depends on
+	// whether the buffers fit in cache, so by default try every other
+	// size from a page up to the largest block.
+	if (argc > 1)
+		lo = hi = strtol(argv[1], NULL, 0);
+
+	cprintf("%7s%13s%13s%13s%13s   (cycles/byte)\n",
+		"size", "memset", "memzero_nt", "memmove", "memcpy_nt");
+	for (order = lo; order <= hi; order += 2)
+		if (membench_row(order) < 0) {
+			cprintf("membench: no free block of order %d\n", order);
+			break;
+		}
+	return 0;
+}
+
+int
+mon_kexec(int argc, char **argv, struct Trapframe *tf)
+{
+	extern pde_t entry_pgdir[];
+	struct Boottime *bt = (struct Boottime *) (KERNBASE + BOOTTIME_PA);
+
+	// We can only reenter our own boot loader, and only if it is the
+	// one that booted us (GRUB doesn't leave it in memory).
+	if (bt->bt_magic != BOOTTIME_MAGIC
+	    || *(uint16_t *) (KERNBASE + BOOTREENTRY - 2) != 0xAA55) {
+		cprintf("kexec: boot loader is not resident\n");
+		return 0;
+	}
+
+	cprintf("Reloading kernel...\n");
+	cons_flush();
+	__asm __volatile("cli");
+	// entry_pgdir identity maps low memory, so the loader
+	// can switch paging off underneath itself
+	lcr3(PADDR(entry_pgdir));
+	((void (*)(void)) BOOTREENTRY)();
+	panic("kexec: boot loader returned");
+}
+
 int
 mon_backtrace(int argc, char **argv, struct Trapframe *tf)
 {
@@ -0,0 +1,464 @@
+/* See COPYRIGHT for copyright information. */
+
+#include <inc/x86.h>
+#include <inc/mmu.h>
+#include <inc/error.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+#include <inc/multiboot.h>
+
+#include <kern/pmap.h>
+#include <kern/kclock.h>
+
+// These variables are set by i386_detect_memory()
+size_t npages;			// Amount of physical memory (in pages)
+static size_t npages_basemem;	// Amount of base memory (in pages)
+
+// Usable RAM as [start, end) physical address ranges, from the
+// boot loader's memory map or, failing that, from NVRAM.
+#define NMEMREGION	32
+static struct Memregion {
+	physaddr_t start;
+	physaddr_t end;
+} memregion[NMEMREGION];
+static int nmemregion;
+
+// End of the boot modules (e.g., an initial ramdisk) the boot loader
+// placed past the kernel, which boot_alloc must not hand out.
+static physaddr_t modules_end;
+
+// These variables are set in mem_init()
+struct Page *pages;		// Physical page state array
+
+// Buddy allocator free lists: free_area[k] is the page number of the
+// first free block of 2^k pages (0 if none), and there are nfree[k].
+static uint16_t free_area[PAGE_MAXORDER + 1];
+static size_t nfree[PAGE_MAXORDER + 1];
+
+// Pages zeroed ahead of time for page_alloc(ALLOC_ZERO), linked
+// through pp_next.  They are allocated as far as the buddy allocator
+// is concerned.  page_zero_idle() tops the pool up to ZERO_POOL_PAGES.
+#define ZERO_POOL_PAGES	64
+static uint16_t zero_pool;
+static size_t nzero;
+
+// Saved by kern/entry.S from the registers the boot loader set
+extern uint32_t multiboot_magic, multiboot_info;
+
+// All of physical memory is mapped at KERNBASE, so the kernel can
+// use at most this much of it.
+#define MAXPHYSMEM	((physaddr_t) -KERNBASE)
+
+
+// --------------------------------------------------------------
+// Detect machine's physical memory setup.
+// --------------------------------------------------------------
+
+// entry_pgdir maps physical memory up to MAXPHYSMEM at KERNBASE (see
+// entrypgdir.c).  Return the kernel virtual address of [pa, pa+len),
+// or NULL if it is not mapped.
+static void *
+early_kaddr(physaddr_t pa, size_t len)
+{
+	if (pa + len < pa || pa + len > MAXPHYSMEM)
+		return NULL;
+	return (void *) (pa + KERNBASE);
+}
+
+static void
+add_memregion(uint64_t start, uint64_t end)
+{
+	if (end > MAXPHYSMEM)
+		end = MAXPHYSMEM;
+	if (start >= end || nmemregion == NMEMREGION)
+		return;
+
+	memregion[nmemregion].start = start;
+	memregion[nmemregion].end = end;
+	nmemregion++;
+
+	npages = MAX(npages, (size_t) (ROUNDUP(end, PGSIZE) / PGSIZE));
+	if (start == 0)
+		npages_basemem = MIN(end, IOPHYSMEM) / PGSIZE;
+}
+
+// Fill memregion from the Multiboot information GRUB or boot/main.c
+// handed us.  Returns 0 if there was none.
+static int
+multiboot_detect_memory(void)
+{
+	struct Multiboot_info *mbi;
+	struct Multiboot_mmap *mm;
+	struct Multiboot_mod *mod;
+	uint32_t off, i;
+
+	if (multiboot_magic != MULTIBOOT_BOOTLOADER_MAGIC
+	    || !(mbi = early_kaddr(multiboot_info, sizeof(*mbi))))
+		return 0;
+
+	if (mbi->flags & MULTIBOOT_INFO_MODS) {
+		for (i = 0; i < mbi->mods_count; i++) {
+			mod = early_kaddr(mbi->mods_addr + i * sizeof(*mod),
+					  sizeof(*mod));
+			if (!mod)
+				break;
+			modules_end = MAX(modules_end, (physaddr_t) mod->mod_end);
+		}
+	}
+
+	if (mbi->flags & MULTIBOOT_INFO_MEM_MAP) {
+		for (off = 0; off + sizeof(*mm) <= mbi->mmap_length;
+		     off += mm->size + 4) {
+			mm = early_kaddr(mbi->mmap_addr + off, sizeof(*mm));
+			if (!mm)
+				break;
+			if (mm->type == MULTIBOOT_MEMORY_AVAILABLE)
+				add_memregion(mm->addr, mm->addr + mm->len);
+		}
+		if (nmemregion > 0)
+			return 1;
+	}
+
+	if (mbi->flags & MULTIBOOT_INFO_MEMORY) {
+		add_memregion(0, mbi->mem_lower * 1024);
+		add_memregion(EXTPHYSMEM,
+			      EXTPHYSMEM + (uint64_t) mbi->mem_upper * 1024);
+		return 1;
+	}
+	return 0;
+}
+
+static int
+nvram_read(int r)
+{
+	return mc146818_read(r) | (mc146818_read(r + 1) << 8);
+}
+
+static void
+i386_detect_memory(void)
+{
+	size_t basemem, extmem, ext16mem, totalmem;
+	const char *source;
+	int i;
+
+	if (multiboot_detect_memory())
+		source = "multiboot";
+	else {
+		// Use CMOS calls to measure available base & extended memory.
+		// (CMOS calls return results in kilobytes.)
+		basemem = nvram_read(NVRAM_BASELO);
+		extmem = nvram_read(NVRAM_EXTLO);
+		ext16mem = nvram_read(NVRAM_EXT16LO) * 64;
+
+		// Calculate the number of physical pages available in both
+		// base and extended memory.
+		if (ext16mem)
+			totalmem = 16 * 1024 + ext16mem;
+		else if (extmem)
+			totalmem = 1 * 1024 + extmem;
+		else
+			totalmem = basemem;
+
+		add_memregion(0, basemem * 1024);
+		add_memregion(EXTPHYSMEM, (uint64_t) totalmem * 1024);
+		source = "nvram";
+	}
+
+	totalmem = 0;
+	for (i = 0; i < nmemregion; i++)
+		totalmem += (memregion[i].end - memregion[i].start) / 1024;
+
+	cprintf("Physical memory: %uK available, base = %uK, top = %uK (%s)\n",
+		totalmem, npages_basemem * PGSIZE / 1024,
+		npages * PGSIZE / 1024, source);
+}
+
+
+// --------------------------------------------------------------
+// Set up memory mappings above UTOP.
+// --------------------------------------------------------------
+
+// This simple physical memory allocator is used only while JOS is setting
+// up its virtual memory system.  page_alloc() is the real allocator.
+//
+// If n>0, allocates enough pages of contiguous physical memory to hold 'n'
+// bytes.  Doesn't initialize the memory.  Returns a kernel virtual address.
+//
+// If n==0, returns the address of the next free page without allocating
+// anything.
+//
+// If we're out of memory, boot_alloc should panic.
+// This function may ONLY be used during initialization,
+// before the buddy allocator's free lists have been set up.
+static void *
+boot_alloc(uint32_t n)
+{
+	static char *nextfree;	// virtual address of next byte of free memory
+	char *result;
+
+	// Initialize nextfree if this is the first time.
+	// 'end' is a magic symbol automatically generated by the linker,
+	// which points to the end of the kernel's bss segment:
+	// the first virtual address that the linker did *not* assign
+	// to any kernel code or global variables.
+	// Boot modules follow the kernel, so start past them too.
+	if (!nextfree) {
+		extern char end[];
+		nextfree = ROUNDUP((char *) end, PGSIZE);
+		if (modules_end > PADDR(nextfree))
+			nextfree = ROUNDUP((char *) KERNBASE + modules_end, PGSIZE);
+	}
+
+	result = nextfree;
+	nextfree = ROUNDUP(nextfree + n, PGSIZE);
+	if (!early_kaddr(PADDR(result), nextfree - result))
+		panic("boot_alloc: out of memory");
+	return result;
+}
+
+// Set up the physical page state.
+//
+// Find out how much memory the machine has from the boot loader's memory
+// map, allocate the 'pages' array and build the free list from the map's
+// usable regions, without touching the pages themselves.
+void
+mem_init(void)
+{
+	// Find out how much memory the machine has (npages & npages_basemem).
+	i386_detect_memory();
+
+	// Allocate an array of npages 'struct Page's and store it in 'pages'.
+	pages = boot_alloc(npages * sizeof(struct Page));
+
+	page_init();
+}
+
+// --------------------------------------------------------------
+// Tracking of physical pages.
+// The 'pages' array has one 'struct Page' entry per physical page.
+// Pages are reference counted, and free pages are kept by a buddy
+// allocator: a free block of 2^k pages starts at a page number that is
+// a multiple of 2^k, and its "buddy" is the block of the same size it
+// was split from, whose page number differs only in bit k.  Freeing a
+// block whose buddy is also free merges the two, so allocation and
+// freeing each take O(PAGE_MAXORDER) steps.
+// --------------------------------------------------------------
+
+//
+// Initialize page structure and memory free lists.
+// After this is done, NEVER use boot_alloc again.  ONLY use the page
+// allocator functions below to allocate and deallocate physical
+// memory via the free lists.
+//
+void
+page_init(void)
+{
+	physaddr_t pa, start, end, first_free;
+	struct Page *pp;
+	size_t i;
+	int r;
+
+	// Every page starts out in use; only the usable regions of the
+	// memory map contribute free pages.  Within them, keep
+	//  1) physical page 0, which holds the real-mode IDT, the BIOS
+	//     structures and the boot loader's handoff records,
+	//  2) [BOOTLOADER, BOOTLOADER_END): the resident boot loader, and
+	//  3) [IOPHYSMEM, first_free): the IO hole, the kernel, any boot
+	//     modules and everything boot_alloc handed out.
+	first_free = PADDR(boot_alloc(0));
+	for (i = 0; i <= PAGE_MAXORDER; i++) {
+		free_area[i] = 0;
+		nfree[i] = 0;
+	}
+	for (i = 0; i < npages; i++) {
+		pages[i].pp_ref = 1;
+		pages[i].pp_flags = 0;
+	}
+
+	for (r = 0; r < nmemregion; r++) {
+		start = ROUNDUP(memregion[r].start, PGSIZE);
+		end = ROUNDDOWN(memregion[r].end, PGSIZE);
+		for (pa = MAX(start, (physaddr_t) PGSIZE); pa < end; pa += PGSIZE) {
+			if (pa >= BOOTLOADER && pa < BOOTLOADER_END)
+				pa = BOOTLOADER_END;
+			if (pa >= IOPHYSMEM && pa < first_free)
+				pa = first_free;
+			if (pa >= end)
+				break;
+			pp = pa2page(pa);
+			if (pp->pp_ref == 0)	// overlapping map entries
+				continue;
+			pp->pp_ref = 0;
+			page_free_order(pp, 0);	// coalesces as it goes
+		}
+	}
+}
+
+// Put free block 'pp' of 2^order pages at the head of its free list
+static void
+free_area_insert(int order, struct Page *pp)
+{
+	uint16_t pn = pp - pages;
+
+	pp->pp_order = order;
+	pp->pp_flags |= PP_FREE;
+	pp->pp_prev = 0;
+	pp->pp_next = free_area[order];
+	if (free_area[order])
+		pages[free_area[order]].pp_prev = pn;
+	free_area[order] = pn;
+	nfree[order]++;
+}
+
+// Take free block 'pp' of 2^order pages off its free list
+static void
+free_area_remove(int order, struct Page *pp)
+{
+	if (pp->pp_prev)
+		pages[pp->pp_prev].pp_next = pp->pp_next;
+	else
+		free_area[order] = pp->pp_next;
+	if (pp->pp_next)
+		pages[pp->pp_next].pp_prev = pp->pp_prev;
+	pp->pp_flags &= ~PP_FREE;
+	nfree[order]--;
+}
+
+// Return the pre-zeroed pages to the free lists
+static void
+zero_pool_drain(void)
+{
+	struct Page *pp;
+
+	while (zero_pool) {
+		pp = &pages[zero_pool];
+		zero_pool = pp->pp_next;
+		nzero--;
+		page_free_order(pp, 0);
+	}
+}
+
+// When the CPU has nothing better to do, zero a free page for the
+// pre-zeroed pool.  Returns 1 if it did any work.
+int
+page_zero_idle(void)
+{
+	struct Page *pp;
+
+	if (!pages || nzero >= ZERO_POOL_PAGES)
+		return 0;
+	if ((pp = page_alloc_order(0, 0)) == NULL)
+		return 0;
+	// non-temporal, so zeroing ahead doesn't evict anything useful
+	memzero_nt(page2kva(pp), PGSIZE);
+	pp->pp_next = zero_pool;
+	zero_pool = pp - pages;
+	nzero++;
+	return 1;
+}
+
+//
+// Allocates 2^order physically contiguous pages, aligned to their size.
+// Does NOT increment the reference counts of the pages.
+// If (alloc_flags & ALLOC_ZERO), fills the pages with '\0' bytes,
+// taking an order-0 page from the pre-zeroed pool if there is one.
+//
+// Returns the first page, or NULL if no free block is large enough.
+//
+struct Page *
+page_alloc_order(int order, int alloc_flags)
+{
+	struct Page *pp;
+	int k;
+
+	if (order < 0 || order > PAGE_MAXORDER)
+		return NULL;
+	if (order == 0 && (alloc_flags & ALLOC_ZERO) && zero_pool) {
+		pp = &pages[zero_pool];
+		zero_pool = pp->pp_next;
+		nzero--;
+		return pp;
+	}
+
+	for (k = order; k <= PAGE_MAXORDER; k++)
+		if (free_area[k])
+			break;
+	if (k > PAGE_MAXORDER) {
+		// the pool is only worth keeping while memory is plentiful
+		if (!zero_pool)
+			return NULL;
+		zero_pool_drain();
+		return page_alloc_order(order, alloc_flags);
+	}
+
+	pp = &pages[free_area[k]];
+	free_area_remove(k, pp);
+	pp->pp_order = order;
+
+	// Split the block, returning the upper halves to the free lists
+	while (k > order) {
+		k--;
+		free_area_insert(k, pp + (1 << k));
+	}
+	if (alloc_flags & ALLOC_ZERO)
+		memset(page2kva(pp), 0, PGSIZE << order);
+	return pp;
+}
+
+//
+// Return a block of 2^order pages from page_alloc_order to the free
+// lists, merging it with its buddies while they are free.
+// (The pages' pp_ref fields should all be 0.)
+//
+void
+page_free_order(struct Page *pp, int order)
+{
+	struct Page *buddy;
+	size_t pn;
+
+	assert(pp->pp_ref == 0 && !(pp->pp_flags & PP_FREE));
+	assert(order >= 0 && order <= PAGE_MAXORDER);
+	pn = pp - pages;
+	assert(pn % (1 << order) == 0);
+
+	for (; order < PAGE_MAXORDER; order++) {
+		if ((pn ^ (1 << order)) >= npages)
+			break;
+		buddy = &pages[pn ^ (1 << order)];
+		if (!(buddy->pp_flags & PP_FREE) || buddy->pp_order != order)
+			break;
+		free_area_remove(order, buddy);
+		pn &= ~(1 << order);
+	}
+	free_area_insert(order, &pages[pn]);
+}
+
+// Return the number of free blocks of 2^order pages
+size_t
+page_free_blocks(int order)
+{
+	return nfree[order];
+}
+
+//
+// Allocates a physical page.
+// Does NOT increment the reference count of the page - the caller must do
+// these if necessary (either explicitly or via page_insert).
+//
+// Returns NULL if out of free memory.
+//
+struct Page *
+page_alloc(int alloc_flags)
+{
+	return page_alloc_order(0, alloc_flags);
+}
+
+//
+// Return a page to the free list.
+// (This function should only be called when pp->pp_ref reaches 0.)
+//
+void
+page_free(struct Page *pp)
+{
+	page_free_order(pp, 0);
+}
@@ -0,0 +1,81 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_PMAP_H
+#define JOS_KERN_PMAP_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/memlayout.h>
+#include <inc/assert.h>
+
+extern char bootstacktop[], bootstack[];
+
+extern struct Page *pages;
+extern size_t npages;
+
+/* This macro takes a kernel virtual address -- an address that points above
+ * KERNBASE, where the machine's maximum 256MB of physical memory is mapped --
+ * and returns the corresponding physical address.  It panics if you pass it a
+ * non-kernel virtual address.
+ */
+#define PADDR(kva)						\
+({								\
+	physaddr_t __m_kva = (physaddr_t) (kva);		\
+	if (__m_kva < KERNBASE)					\
+		panic("PADDR called with invalid kva %08lx", __m_kva);\
+	__m_kva - KERNBASE;					\
+})
+
+/* This macro takes a physical address and returns the corresponding kernel
+ * virtual address.  It panics if you pass an invalid physical address. */
+#define KADDR(pa)						\
+({								\
+	physaddr_t __m_pa = (pa);				\
+	uint32_t __m_ppn = PPN(__m_pa);				\
+	if (__m_ppn >= npages)					\
+		panic("KADDR called with invalid pa %08lx", __m_pa);\
+	(void*) (__m_pa + KERNBASE);				\
+})
+
+
+void	mem_init(void);
+
+enum {
+	// For page_alloc, zero the returned physical page.
+	ALLOC_ZERO = 1<<0,
+};
+
+// The buddy allocator hands out runs of 2^order contiguous pages,
+// aligned to their size, for order 0 through PAGE_MAXORDER (4MB).
+#define PAGE_MAXORDER	10
+
+void	page_init(void);
+struct Page *page_alloc(int alloc_flags);
+void	page_free(struct Page *pp);
+struct Page *page_alloc_order(int order, int alloc_flags);
+void	page_free_order(struct Page *pp, int order);
+size_t	page_free_blocks(int order);
+int	page_zero_idle(void);
+
+static inline physaddr_t
+page2pa(struct Page *pp)
+{
+	return (pp - pages) << PGSHIFT;
+}
+
+static inline struct Page*
+pa2page(physaddr_t pa)
+{
+	if (PPN(pa) >= npages)
+		panic("pa2page called with invalid pa");
+	return &pages[PPN(pa)];
+}
+
+static inline void*
+page2kva(struct Page *pp)
+{
+	return KADDR(page2pa(pp));
+}
+
+#endif /* !JOS_KERN_PMAP_H */
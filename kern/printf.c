@@ -1,25 +1,40 @@
 // Simple implementation of cprintf console output for the kernel,
-// based on printfmt() and the kernel console's cputchar().
+// based on printfmt() and the kernel console's cons_write().
 
 #include <inc/types.h>
 #include <inc/stdio.h>
 #include <inc/stdarg.h>
 
+#define CPRINTBUFSIZE	256
+
+// Output is collected here and handed to the console a span at a time
+struct Printbuf {
+	int idx;	// current buffer index
+	int cnt;	// total bytes printed so far
+	char buf[CPRINTBUFSIZE];
+};
 
 static void
-putch(int ch, int *cnt)
+putch(int ch, struct Printbuf *b)
 {
-	cputchar(ch);
-	*cnt++;
+	b->buf[b->idx++] = ch;
+	if (b->idx == CPRINTBUFSIZE) {
+		cons_write(b->buf, b->idx);
+		b->idx = 0;
+	}
+	b->cnt++;
 }
 
 int
 vcprintf(const char *fmt, va_list ap)
 {
-	int cnt = 0;
+	struct Printbuf b;
 
-	vprintfmt((void*)putch, &cnt, fmt, ap);
-	return cnt;
+	b.idx = 0;
+	b.cnt = 0;
+	vprintfmt((void*)putch, &b, fmt, ap);
+	cons_write(b.buf, b.idx);
+	return b.cnt;
 }
 
 int
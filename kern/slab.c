@@ -0,0 +1,209 @@
+/* See COPYRIGHT for copyright information. */
+
+#include <inc/mmu.h>
+#include <inc/error.h>
+#include <inc/assert.h>
+#include <inc/malloc.h>
+
+#include <kern/pmap.h>
+#include <kern/slab.h>
+
+// The caches behind malloc(), 16 bytes to SLAB_MAXOBJ
+#define NKMALLOC	8
+static struct Kmem_cache kmalloc_caches[NKMALLOC];
+static const char *kmalloc_names[NKMALLOC] = {
+	"kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+	"kmalloc-256", "kmalloc-512", "kmalloc-1024", "kmalloc-max"
+};
+
+void
+slab_init(void)
+{
+	int i;
+
+	for (i = 0; i < NKMALLOC - 1; i++)
+		kmem_cache_init(&kmalloc_caches[i], kmalloc_names[i],
+				16 << i, NULL);
+	kmem_cache_init(&kmalloc_caches[i], kmalloc_names[i],
+			SLAB_MAXOBJ, NULL);
+}
+
+// Set up 'cp' as a cache of 'size'-byte objects.  If 'ctor' is not
+// NULL, it is run on each object when its slab is created, and freed
+// objects must be returned in their constructed state.
+// Returns 0 on success, -E_INVAL if 'size' is too large for a slab.
+int
+kmem_cache_init(struct Kmem_cache *cp, const char *name, size_t size,
+		void (*ctor)(void *))
+{
+	// A constructed object has to survive being free, so its free
+	// list link goes after it rather than over it.
+	size = ROUNDUP(MAX(size, sizeof(void *)), SLAB_ALIGN);
+	cp->kc_link = ctor ? size : 0;
+	if (ctor)
+		size += SLAB_ALIGN;
+	if (size > SLAB_MAXOBJ)
+		return -E_INVAL;
+
+	cp->kc_name = name;
+	cp->kc_size = size;
+	cp->kc_objs = (PGSIZE - ROUNDUP(sizeof(struct Slab), SLAB_ALIGN)) / size;
+	cp->kc_ctor = ctor;
+	LIST_INIT(&cp->kc_partial);
+	LIST_INIT(&cp->kc_full);
+	cp->kc_empty = NULL;
+	cp->kc_nslabs = 0;
+	cp->kc_inuse = 0;
+	return 0;
+}
+
+// Allocate and set up a new cache.  Returns NULL on failure.
+struct Kmem_cache *
+kmem_cache_create(const char *name, size_t size, void (*ctor)(void *))
+{
+	struct Kmem_cache *cp;
+
+	if ((cp = malloc(sizeof(*cp))) == NULL)
+		return NULL;
+	if (kmem_cache_init(cp, name, size, ctor) < 0) {
+		free(cp);
+		return NULL;
+	}
+	return cp;
+}
+
+#define OBJLINK(cp, obj)	(*(void **) ((char *) (obj) + (cp)->kc_link))
+
+// Get a page from the buddy allocator and carve it into objects
+static struct Slab *
+slab_grow(struct Kmem_cache *cp)
+{
+	struct Page *pp;
+	struct Slab *sp;
+	char *obj;
+	size_t i;
+
+	if ((pp = page_alloc(0)) == NULL)
+		return NULL;
+	sp = page2kva(pp);
+	sp->sl_cache = cp;
+	sp->sl_inuse = 0;
+	sp->sl_free = NULL;
+
+	// Thread the free list so the lowest object comes out first
+	obj = (char *) sp + ROUNDUP(sizeof(struct Slab), SLAB_ALIGN)
+		+ (cp->kc_objs - 1) * cp->kc_size;
+	for (i = 0; i < cp->kc_objs; i++, obj -= cp->kc_size) {
+		if (cp->kc_ctor)
+			cp->kc_ctor(obj);
+		OBJLINK(cp, obj) = sp->sl_free;
+		sp->sl_free = obj;
+	}
+	cp->kc_nslabs++;
+	return sp;
+}
+
+// Allocate an object from 'cp'.  Returns NULL if out of memory.
+void *
+kmem_cache_alloc(struct Kmem_cache *cp)
+{
+	struct Slab *sp;
+	void *obj;
+
+	if ((sp = LIST_FIRST(&cp->kc_partial)) == NULL) {
+		if ((sp = cp->kc_empty) != NULL)
+			cp->kc_empty = NULL;
+		else if ((sp = slab_grow(cp)) == NULL)
+			return NULL;
+		LIST_INSERT_HEAD(&cp->kc_partial, sp, sl_link);
+	}
+
+	obj = sp->sl_free;
+	sp->sl_free = OBJLINK(cp, obj);
+	sp->sl_inuse++;
+	cp->kc_inuse++;
+	if (sp->sl_free == NULL) {
+		LIST_REMOVE(sp, sl_link);
+		LIST_INSERT_HEAD(&cp->kc_full, sp, sl_link);
+	}
+	return obj;
+}
+
+// Return 'obj' to 'cp'.  A slab that becomes all free is kept for the
+// next allocation, unless the cache already holds one, in which case
+// its page goes back to the buddy allocator.
+void
+kmem_cache_free(struct Kmem_cache *cp, void *obj)
+{
+	struct Slab *sp = ROUNDDOWN(obj, PGSIZE);
+	struct Page *pp;
+
+	assert(sp->sl_cache == cp && sp->sl_inuse > 0);
+	if (sp->sl_free == NULL) {
+		LIST_REMOVE(sp, sl_link);
+		LIST_INSERT_HEAD(&cp->kc_partial, sp, sl_link);
+	}
+	OBJLINK(cp, obj) = sp->sl_free;
+	sp->sl_free = obj;
+	sp->sl_inuse--;
+	cp->kc_inuse--;
+	if (sp->sl_inuse > 0)
+		return;
+
+	LIST_REMOVE(sp, sl_link);
+	if (cp->kc_empty == NULL) {
+		cp->kc_empty = sp;
+		return;
+	}
+	pp = pa2page(PADDR(sp));
+	pp->pp_ref = 0;
+	page_free(pp);
+	cp->kc_nslabs--;
+}
+
+//
+// malloc() and free().  Requests up to SLAB_MAXOBJ bytes come from the
+// smallest kmalloc cache that fits.  Larger ones get a whole buddy
+// block, whose order page_alloc_order() records in its first page.
+// Since a slab's objects follow its header, only a large allocation
+// is page-aligned, which is how free() tells them apart.
+//
+
+void *
+malloc(size_t size)
+{
+	struct Page *pp;
+	int i;
+
+	if (size == 0)
+		return NULL;
+	if (size <= SLAB_MAXOBJ) {
+		for (i = 0; (16 << i) < size && i < NKMALLOC - 1; i++)
+			/* do nothing */;
+		return kmem_cache_alloc(&kmalloc_caches[i]);
+	}
+
+	for (i = 0; (PGSIZE << i) < size; i++)
+		if (i == PAGE_MAXORDER)
+			return NULL;
+	if ((pp = page_alloc_order(i, 0)) == NULL)
+		return NULL;
+	return page2kva(pp);
+}
+
+void
+free(void *addr)
+{
+	struct Page *pp;
+	struct Slab *sp;
+
+	if (addr == NULL)
+		return;
+	if (addr != ROUNDDOWN(addr, PGSIZE)) {
+		sp = ROUNDDOWN(addr, PGSIZE);
+		kmem_cache_free(sp->sl_cache, addr);
+		return;
+	}
+	pp = pa2page(PADDR(addr));
+	page_free_order(pp, pp->pp_order);
+}
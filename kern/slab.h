@@ -0,0 +1,59 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_SLAB_H
+#define JOS_KERN_SLAB_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <inc/mmu.h>
+#include <inc/queue.h>
+
+/*
+ * Slab allocator.  A cache hands out objects of one size, carved from
+ * single-page slabs it gets from the buddy allocator.  Each slab starts
+ * with a struct Slab, so the slab of any object is the page it lies in,
+ * and keeps its free objects on a list threaded through them; alloc and
+ * free are O(1).  malloc() and free() (inc/malloc.h) are built on a set
+ * of power-of-two caches, falling back to whole pages for large sizes.
+ */
+
+#define SLAB_ALIGN	8	// objects are aligned to this
+
+LIST_HEAD(Slab_list, Slab);
+
+struct Slab {
+	LIST_ENTRY(Slab) sl_link;	// on one of the cache's lists
+	struct Kmem_cache *sl_cache;
+	void *sl_free;			// first free object
+	uint16_t sl_inuse;		// objects allocated
+};
+
+struct Kmem_cache {
+	const char *kc_name;
+	size_t kc_size;			// object size, including the link
+	size_t kc_link;			// offset of the free list link
+	size_t kc_objs;			// objects per slab
+	void (*kc_ctor)(void *);	// run on each object of a new slab
+	struct Slab_list kc_partial;	// slabs with free and used objects
+	struct Slab_list kc_full;	// slabs with no free objects
+	struct Slab *kc_empty;		// one cached all-free slab, or NULL
+	size_t kc_nslabs;
+	size_t kc_inuse;
+};
+
+// Largest object a one-page slab holds at least two of
+#define SLAB_MAXOBJ \
+	(((PGSIZE - ROUNDUP(sizeof(struct Slab), SLAB_ALIGN)) / 2) \
+	 & ~(SLAB_ALIGN - 1))
+
+void	slab_init(void);
+int	kmem_cache_init(struct Kmem_cache *cp, const char *name, size_t size,
+			void (*ctor)(void *));
+struct Kmem_cache *kmem_cache_create(const char *name, size_t size,
+				     void (*ctor)(void *));
+void	*kmem_cache_alloc(struct Kmem_cache *cp);
+void	kmem_cache_free(struct Kmem_cache *cp, void *obj);
+
+#endif /* !JOS_KERN_SLAB_H */
@@ -0,0 +1,80 @@
+// CPU feature detection.
+
+#include <inc/x86.h>
+#include <inc/string.h>
+#include <inc/cpufeature.h>
+
+// In .data rather than the BSS, because i386_init probes the CPU
+// before it clears the BSS (with a routine picked from the results).
+struct Cpu_features cpu_features __attribute__((__section__(".data")));
+
+// Indexed by the bit number of each CPUF_ flag
+const char *const cpu_feature_names[CPUF_NFEATURES] = {
+	"fpu", "pse", "tsc", "pge", "fxsr", "sse", "sse2", "sse3",
+	"ssse3", "sse4.1", "sse4.2", "erms", "invtsc"
+};
+
+// Map a cpuid register bit to a CPUF_ flag
+struct Cpuid_bit {
+	uint32_t bit;
+	uint32_t flag;
+};
+
+static const struct Cpuid_bit leaf1_edx[] = {
+	{ 0, CPUF_FPU }, { 3, CPUF_PSE }, { 4, CPUF_TSC }, { 13, CPUF_PGE },
+	{ 24, CPUF_FXSR }, { 25, CPUF_SSE }, { 26, CPUF_SSE2 }, { 0, 0 }
+};
+static const struct Cpuid_bit leaf1_ecx[] = {
+	{ 0, CPUF_SSE3 }, { 9, CPUF_SSSE3 }, { 19, CPUF_SSE41 },
+	{ 20, CPUF_SSE42 }, { 0, 0 }
+};
+
+static uint32_t
+cpuid_flags(uint32_t reg, const struct Cpuid_bit *bits)
+{
+	uint32_t flags = 0;
+
+	for (; bits->flag; bits++)
+		if (reg & (1 << bits->bit))
+			flags |= bits->flag;
+	return flags;
+}
+
+void
+cpu_probe(void)
+{
+	struct Cpu_features *cf = &cpu_features;
+	uint32_t max, eax, ebx, ecx, edx;
+
+	cf->cf_flags = 0;
+	cpuid(0, &max, &ebx, &ecx, &edx);
+	memcpy(cf->cf_vendor, &ebx, 4);
+	memcpy(cf->cf_vendor + 4, &edx, 4);
+	memcpy(cf->cf_vendor + 8, &ecx, 4);
+	cf->cf_vendor[12] = '\0';
+
+	if (max >= 1) {
+		cpuid(1, &eax, NULL, &ecx, &edx);
+		cf->cf_stepping = eax & 0xF;
+		cf->cf_model = (eax >> 4) & 0xF;
+		cf->cf_family = (eax >> 8) & 0xF;
+		if (cf->cf_family == 0xF)
+			cf->cf_family += (eax >> 20) & 0xFF;
+		if (cf->cf_family >= 6)
+			cf->cf_model |= (eax >> 12) & 0xF0;
+		cf->cf_flags |= cpuid_flags(edx, leaf1_edx);
+		cf->cf_flags |= cpuid_flags(ecx, leaf1_ecx);
+	}
+	if (max >= 7) {
+		cpuid(7, NULL, &ebx, NULL, NULL);
+		if (ebx & (1 << 9))
+			cf->cf_flags |= CPUF_ERMS;
+	}
+
+	cpuid(0x80000000, &max, NULL, NULL, NULL);
+	if (max >= 0x80000007) {
+		cpuid(0x80000007, NULL, NULL, NULL, &edx);
+		if (edx & (1 << 8))
+			cf->cf_flags |= CPUF_INVTSC;
+	}
+}
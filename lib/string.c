@@ -1,6 +1,7 @@
 // Basic string routines.  Not hardware optimized, but not shabby.
 
 #include <inc/string.h>
+#include <inc/cpufeature.h>
 
 // Using assembly for memset/memmove
 // makes some difference on real hardware,
@@ -8,24 +9,51 @@
 // Primespipe runs 3x faster this way.
 #define ASM 1
 
+// The scanning functions below look at a word (4 bytes) per step once
+// the pointer is aligned.  An aligned word never straddles a page, so
+// reading past the end of a string this way can't fault.
+typedef uint32_t __attribute__((__may_alias__)) word_t;
+
+#define WORDMASK	(sizeof(word_t) - 1)
+#define ONES		0x01010101U
+// Nonzero iff word 'w' has a zero byte; the lowest set bit is then the
+// top bit of the first (lowest-addressed) zero byte.
+#define HASZERO(w)	(((w) - ONES) & ~(w) & 0x80808080U)
+// Offset of the lowest-addressed byte of 'm' with a bit set, e.g. the
+// byte HASZERO's result points at
+#define FIRSTBYTE(m)	(__builtin_ctz(m) / 8)
+
 int
 strlen(const char *s)
 {
-	int n;
-
-	for (n = 0; *s != '\0'; s++)
-		n++;
-	return n;
+	const word_t *w;
+	const char *p;
+	uint32_t m;
+
+	for (p = s; (uintptr_t) p & WORDMASK; p++)
+		if (*p == '\0')
+			return p - s;
+	for (w = (const word_t *) p; !(m = HASZERO(*w)); w++)
+		/* do nothing */;
+	return (const char *) w + FIRSTBYTE(m) - s;
 }
 
 int
 strnlen(const char *s, size_t size)
 {
-	int n;
-
-	for (n = 0; size > 0 && *s != '\0'; s++, size--)
-		n++;
-	return n;
+	const char *p;
+	uint32_t m;
+
+	for (p = s; size > 0 && ((uintptr_t) p & WORDMASK); p++, size--)
+		if (*p == '\0')
+			return p - s;
+	for (; size > 0; p += 4, size -= 4) {
+		if ((m = HASZERO(*(const word_t *) p)))
+			return p + MIN((size_t) FIRSTBYTE(m), size) - s;
+		if (size < 4)
+			return p + size - s;
+	}
+	return p - s;
 }
 
 char *
@@ -68,23 +96,58 @@ strlcpy(char *dst, const char *src, size_t size)
 	return dst - dst_in;
 }
 
+// Compare strings a word at a time while both pointers are aligned
+// (otherwise a word of 'q' could straddle a page).  In each word, the
+// first byte that differs or ends 'p' is the lowest set bit of
+// (a ^ b) | HASZERO(a).
 int
 strcmp(const char *p, const char *q)
 {
+	uint32_t a, b, m;
+
+	for (; (uintptr_t) p & WORDMASK; p++, q++)
+		if (*p == '\0' || *p != *q)
+			goto done;
+	if (((uintptr_t) q & WORDMASK) == 0)
+		for (;; p += 4, q += 4) {
+			a = *(const word_t *) p;
+			b = *(const word_t *) q;
+			if ((m = (a ^ b) | HASZERO(a))) {
+				p += FIRSTBYTE(m);
+				q += FIRSTBYTE(m);
+				goto done;
+			}
+		}
 	while (*p && *p == *q)
 		p++, q++;
+done:
 	return (int) ((unsigned char) *p - (unsigned char) *q);
 }
 
 int
 strncmp(const char *p, const char *q, size_t n)
 {
+	uint32_t a, b, m;
+
+	for (; n > 0 && ((uintptr_t) p & WORDMASK); n--, p++, q++)
+		if (*p == '\0' || *p != *q)
+			goto done;
+	if (((uintptr_t) q & WORDMASK) == 0)
+		for (; n >= 4; n -= 4, p += 4, q += 4) {
+			a = *(const word_t *) p;
+			b = *(const word_t *) q;
+			if ((m = (a ^ b) | HASZERO(a))) {
+				p += FIRSTBYTE(m);
+				q += FIRSTBYTE(m);
+				goto done;
+			}
+		}
 	while (n > 0 && *p && *p == *q)
 		n--, p++, q++;
 	if (n == 0)
 		return 0;
-	else
-		return (int) ((unsigned char) *p - (unsigned char) *q);
+done:
+	return (int) ((unsigned char) *p - (unsigned char) *q);
 }
 
 // Return a pointer to the first occurrence of 'c' in 's',
@@ -92,10 +155,8 @@ strncmp(const char *p, const char *q, size_t n)
 char *
 strchr(const char *s, char c)
 {
-	for (; *s; s++)
-		if (*s == c)
-			return (char *) s;
-	return 0;
+	s = strfind(s, c);
+	return *s ? (char *) s : 0;
 }
 
 // Return a pointer to the first occurrence of 'c' in 's',
@@ -103,60 +164,244 @@ strchr(const char *s, char c)
 char *
 strfind(const char *s, char c)
 {
-	for (; *s; s++)
-		if (*s == c)
-			break;
-	return (char *) s;
+	uint32_t cs, w, m;
+
+	for (; (uintptr_t) s & WORDMASK; s++)
+		if (*s == '\0' || *s == c)
+			return (char *) s;
+	// a byte equal to c is a zero byte of w ^ cs
+	cs = (unsigned char) c * ONES;
+	for (;; s += 4) {
+		w = *(const word_t *) s;
+		if ((m = HASZERO(w) | HASZERO(w ^ cs)))
+			return (char *) s + FIRSTBYTE(m);
+	}
 }
 
+// Routines with several implementations call them through pointers,
+// which string_init() points at the best one for the CPU.  Until then
+// (and without ASM) they use the plain versions.  The pointers are
+// initialized, so they live in .data and survive the BSS clear.
+
+// With ERMSB ("fast strings"), a single rep movsb or rep stosb is as
+// fast as anything for all but short buffers.
+#define ERMS_MIN	128
+
 #if ASM
+// Fill 'nword' 32-bit words at 'p' with 'c' (p is 4-byte aligned),
+// then 'ntail' bytes with its low byte.
+static void
+fill_words(char *p, uint32_t c, size_t nword, size_t ntail)
+{
+	asm volatile("cld; rep stosl\n"
+		: "+D" (p), "+c" (nword) : "a" (c) : "cc", "memory");
+	asm volatile("rep stosb\n"
+		: "+D" (p), "+c" (ntail) : "a" (c) : "cc", "memory");
+}
+
+// Store bytes up to 4-byte alignment, then words, then the tail.
+static void
+memset_words(char *p, int c, size_t n)
+{
+	size_t head;
+
+	head = MIN(-(uintptr_t) p & 3, n);
+	n -= head;
+	asm volatile("cld; rep stosb\n"
+		: "+D" (p), "+c" (head) : "a" (c) : "cc", "memory");
+	fill_words(p, c * 0x01010101, n / 4, n % 4);
+}
+
+static void
+memset_erms(char *p, int c, size_t n)
+{
+	if (n < ERMS_MIN) {
+		memset_words(p, c, n);
+		return;
+	}
+	asm volatile("cld; rep stosb\n"
+		: "+D" (p), "+c" (n) : "a" (c) : "cc", "memory");
+}
+
+static void (*memset_impl)(char *, int, size_t) = memset_words;
+
 void *
 memset(void *v, int c, size_t n)
 {
-	char *p;
+	memset_impl(v, c & 0xFF, n);
+	return v;
+}
 
-	if (n == 0)
-		return v;
-	if ((int)v%4 == 0 && n%4 == 0) {
-		c &= 0xFF;
-		c = (c<<24)|(c<<16)|(c<<8)|c;
-		asm volatile("cld; rep stosl\n"
-			:: "D" (v), "a" (c), "c" (n/4)
-			: "cc", "memory");
-	} else
-		asm volatile("cld; rep stosb\n"
-			:: "D" (v), "a" (c), "c" (n)
-			: "cc", "memory");
+// Fill 'n' 16-bit cells at 'v' (2-byte aligned) with 'c', e.g. to
+// blank CGA text with attribute+space.
+void *
+memset16(void *v, uint16_t c, size_t n)
+{
+	uint16_t *p = v;
+
+	if (n > 0 && ((uintptr_t) p & 2)) {
+		*p++ = c;
+		n--;
+	}
+	fill_words((char *) p, c | ((uint32_t) c << 16), n / 2, 0);
+	if (n % 2)
+		p[n - 1] = c;
 	return v;
 }
 
+// Fill 'n' 32-bit words at 'v' (4-byte aligned) with 'c'
+void *
+memset32(void *v, uint32_t c, size_t n)
+{
+	fill_words(v, c, n, 0);
+	return v;
+}
+
+// Copy forward: an unaligned head up to a 4-byte boundary of 'dst', then
+// words, then the tail.
+static void
+copy_forward_words(char *d, const char *s, size_t n)
+{
+	size_t cnt;
+
+	cnt = MIN(-(uintptr_t) d & 3, n);
+	n -= cnt;
+	asm volatile("cld; rep movsb\n"
+		: "+D" (d), "+S" (s), "+c" (cnt) : : "cc", "memory");
+	cnt = n / 4;
+	asm volatile("rep movsl\n"
+		: "+D" (d), "+S" (s), "+c" (cnt) : : "cc", "memory");
+	cnt = n % 4;
+	asm volatile("rep movsb\n"
+		: "+D" (d), "+S" (s), "+c" (cnt) : : "cc", "memory");
+}
+
+static void
+copy_forward_erms(char *d, const char *s, size_t n)
+{
+	if (n < ERMS_MIN) {
+		copy_forward_words(d, s, n);
+		return;
+	}
+	asm volatile("cld; rep movsb\n"
+		: "+D" (d), "+S" (s), "+c" (n) : : "cc", "memory");
+}
+
+static void (*copy_forward)(char *, const char *, size_t) = copy_forward_words;
+
+// Copy backward, for overlapping moves to a higher address: the mirror
+// image of copy_forward_words(), aligning the end of 'dst'.  (Fast
+// strings don't apply going backward.)  Each step leaves %edi and %esi
+// just below what it copied, which is where the next one starts.
+static void
+copy_backward(char *d, const char *s, size_t n)
+{
+	size_t cnt;
+
+	d += n - 1;
+	s += n - 1;
+	cnt = MIN((uintptr_t) (d + 1) & 3, n);
+	n -= cnt;
+	asm volatile("std; rep movsb\n"
+		: "+D" (d), "+S" (s), "+c" (cnt) : : "cc", "memory");
+	d -= 3;
+	s -= 3;
+	cnt = n / 4;
+	asm volatile("rep movsl\n"
+		: "+D" (d), "+S" (s), "+c" (cnt) : : "cc", "memory");
+	d += 3;
+	s += 3;
+	cnt = n % 4;
+	asm volatile("rep movsb\n"
+		: "+D" (d), "+S" (s), "+c" (cnt) : : "cc", "memory");
+	// Some versions of GCC rely on DF being clear
+	asm volatile("cld" ::: "cc");
+}
+
 void *
 memmove(void *dst, const void *src, size_t n)
 {
 	const char *s;
 	char *d;
-	
+
 	s = src;
 	d = dst;
-	if (s < d && s + n > d) {
-		s += n;
-		d += n;
-		if ((int)s%4 == 0 && (int)d%4 == 0 && n%4 == 0)
-			asm volatile("std; rep movsl\n"
-				:: "D" (d-4), "S" (s-4), "c" (n/4) : "cc", "memory");
-		else
-			asm volatile("std; rep movsb\n"
-				:: "D" (d-1), "S" (s-1), "c" (n) : "cc", "memory");
-		// Some versions of GCC rely on DF being clear
-		asm volatile("cld" ::: "cc");
-	} else {
-		if ((int)s%4 == 0 && (int)d%4 == 0 && n%4 == 0)
-			asm volatile("cld; rep movsl\n"
-				:: "D" (d), "S" (s), "c" (n/4) : "cc", "memory");
-		else
-			asm volatile("cld; rep movsb\n"
-				:: "D" (d), "S" (s), "c" (n) : "cc", "memory");
-	}
+	if (s < d && s + n > d)
+		copy_backward(d, s, n);
+	else
+		copy_forward(d, s, n);
+	return dst;
+}
+
+// Unlike memmove, the buffers must not overlap.  GCC emits calls to
+// this for structure assignments.
+void *
+memcpy(void *dst, const void *src, size_t n)
+{
+	copy_forward(dst, src, n);
+	return dst;
+}
+
+// Zero whole 64-byte (cache line) chunks with MOVNTI, which needs only
+// SSE2 and no SSE register state.
+static void *
+memzero_movnti(void *v, size_t n)
+{
+	char *p = v;
+	size_t head, nline;
+
+	if (n < 128)
+		return memset(v, 0, n);
+
+	head = -(uintptr_t) p & 63;
+	memset(p, 0, head);
+	p += head;
+	n -= head;
+	nline = n / 64;
+	asm volatile("1:\n\t"
+		"movnti %2, 0(%0); movnti %2, 4(%0)\n\t"
+		"movnti %2, 8(%0); movnti %2, 12(%0)\n\t"
+		"movnti %2, 16(%0); movnti %2, 20(%0)\n\t"
+		"movnti %2, 24(%0); movnti %2, 28(%0)\n\t"
+		"movnti %2, 32(%0); movnti %2, 36(%0)\n\t"
+		"movnti %2, 40(%0); movnti %2, 44(%0)\n\t"
+		"movnti %2, 48(%0); movnti %2, 52(%0)\n\t"
+		"movnti %2, 56(%0); movnti %2, 60(%0)\n\t"
+		"addl $64, %0; decl %1; jnz 1b\n\t"
+		"sfence"
+		: "+r" (p), "+r" (nline) : "r" (0) : "cc", "memory");
+	memset(p, 0, n % 64);
+	return v;
+}
+
+// Copy 16-byte chunks, loading into registers and storing with MOVNTI
+static void *
+memcpy_movnti(void *dst, const void *src, size_t n)
+{
+	const char *s = src;
+	char *d = dst;
+	size_t head, nchunk;
+	uint32_t t0, t1;
+
+	if (n < 128)
+		return memmove(dst, src, n);
+
+	head = -(uintptr_t) d & 15;
+	memmove(d, s, head);
+	d += head;
+	s += head;
+	n -= head;
+	nchunk = n / 16;
+	asm volatile("1:\n\t"
+		"movl 0(%1), %2; movl 4(%1), %3\n\t"
+		"movnti %2, 0(%0); movnti %3, 4(%0)\n\t"
+		"movl 8(%1), %2; movl 12(%1), %3\n\t"
+		"movnti %2, 8(%0); movnti %3, 12(%0)\n\t"
+		"addl $16, %1; addl $16, %0; decl %4; jnz 1b\n\t"
+		"sfence"
+		: "+r" (d), "+r" (s), "=&r" (t0), "=&r" (t1), "+r" (nchunk)
+		: : "cc", "memory");
+	memmove(d, s, n % 16);
 	return dst;
 }
 
@@ -176,7 +421,25 @@ memset(void *v, int c, size_t n)
 	return v;
 }
 
-/* no memcpy - use memmove instead */
+void *
+memset16(void *v, uint16_t c, size_t n)
+{
+	uint16_t *p = v;
+
+	while (n-- > 0)
+		*p++ = c;
+	return v;
+}
+
+void *
+memset32(void *v, uint32_t c, size_t n)
+{
+	uint32_t *p = v;
+
+	while (n-- > 0)
+		*p++ = c;
+	return v;
+}
 
 void *
 memmove(void *dst, const void *src, size_t n)
@@ -197,22 +460,92 @@ memmove(void *dst, const void *src, size_t n)
 
 	return dst;
 }
+
+void *
+memcpy(void *dst, const void *src, size_t n)
+{
+	const char *s;
+	char *d;
+
+	s = src;
+	d = dst;
+	while (n-- > 0)
+		*d++ = *s++;
+
+	return dst;
+}
 #endif
 
-/* sigh - gcc emits references to this for structure assignments! */
-/* it is *not* prototyped in inc/string.h - do not use directly. */
+static void *
+memzero_cached(void *v, size_t n)
+{
+	return memset(v, 0, n);
+}
+
+static void *(*memzero_nt_impl)(void *, size_t) = memzero_cached;
+static void *(*memcpy_nt_impl)(void *, const void *, size_t) = memmove;
+
+// Zero 'n' bytes at 'v' with non-temporal stores, which go around the
+// cache: for large buffers that won't be read again soon (the BSS, pages
+// zeroed ahead of time), so zeroing them doesn't evict useful lines.
+// Without SSE2 this is memset.
 void *
-memcpy(void *dst, void *src, size_t n)
+memzero_nt(void *v, size_t n)
+{
+	return memzero_nt_impl(v, n);
+}
+
+// Copy 'n' bytes from 'src' to 'dst' with non-temporal stores, like
+// memzero_nt().  The copy runs forward, so the buffers may overlap only
+// if 'dst' is below 'src'.
+void *
+memcpy_nt(void *dst, const void *src, size_t n)
+{
+	return memcpy_nt_impl(dst, src, n);
+}
+
+struct Dispatch string_dispatch[] = {
+	{ "memset", ASM ? "rep stosl" : "byte loop" },
+	{ "memcpy/memmove", ASM ? "rep movsl" : "byte loop" },
+	{ "memzero_nt", "memset" },
+	{ "memcpy_nt", "memmove" },
+	{ NULL, NULL }
+};
+
+// Pick each routine's implementation from the probed CPU features
+void
+string_init(void)
 {
-	return memmove(dst, src, n);
+#if ASM
+	if (cpu_has(CPUF_ERMS)) {
+		memset_impl = memset_erms;
+		string_dispatch[0].impl = "rep stosb (ERMSB)";
+		copy_forward = copy_forward_erms;
+		string_dispatch[1].impl = "rep movsb (ERMSB)";
+	}
+	if (cpu_has(CPUF_SSE2)) {
+		memzero_nt_impl = memzero_movnti;
+		string_dispatch[2].impl = "movnti";
+		memcpy_nt_impl = memcpy_movnti;
+		string_dispatch[3].impl = "movnti";
+	}
+#endif
 }
 
+// Compare a word at a time (x86 allows unaligned loads, and we never
+// read past 'n'), then find the first differing byte with a bit scan.
 int
 memcmp(const void *v1, const void *v2, size_t n)
 {
 	const uint8_t *s1 = (const uint8_t *) v1;
 	const uint8_t *s2 = (const uint8_t *) v2;
+	uint32_t x;
 
+	for (; n >= 4; n -= 4, s1 += 4, s2 += 4)
+		if ((x = *(const word_t *) s1 ^ *(const word_t *) s2)) {
+			x = FIRSTBYTE(x);
+			return (int) s1[x] - (int) s2[x];
+		}
 	while (n-- > 0) {
 		if (*s1 != *s2)
 			return (int) *s1 - (int) *s2;
@@ -225,11 +558,17 @@ memcmp(const void *v1, const void *v2, size_t n)
 void *
 memfind(const void *s, int c, size_t n)
 {
-	const void *ends = (const char *) s + n;
-	for (; s < ends; s++)
-		if (*(const unsigned char *) s == (unsigned char) c)
-			break;
-	return (void *) s;
+	const unsigned char *p = s, *ends = p + n;
+	uint32_t cs, m;
+
+	for (; p < ends && ((uintptr_t) p & WORDMASK); p++)
+		if (*p == (unsigned char) c)
+			return (void *) p;
+	cs = (unsigned char) c * ONES;
+	for (; p < ends; p += 4)
+		if ((m = HASZERO(*(const word_t *) p ^ cs)))
+			return (void *) MIN(p + FIRSTBYTE(m), ends);
+	return (void *) ends;
 }
 
 long